@@ -0,0 +1,413 @@
+/* wrapper overhead vs. raw PETSc, with Google Benchmark. There's no build system, so build it by hand against
+ * your PETSc (C++14 or later, which Google Benchmark needs). The handles' destroy policy follows PETSc's debug
+ * build unless you pick one: add -DPETSC_SMART_PTR_FAST_DESTROY or -DPETSC_SMART_PTR_CHECKED_DESTROY to say which
+ * one you're measuring:
+ *
+ * mpicxx -O3 -std=c++17 -I include -I$PETSC_DIR/include -I$PETSC_DIR/$PETSC_ARCH/include bench/petsc_smart_ptr_bench.cpp \
+ * 	-L$PETSC_DIR/$PETSC_ARCH/lib -Wl,-rpath,$PETSC_DIR/$PETSC_ARCH/lib -lpetsc -lbenchmark -lpthread -o petsc_smart_ptr_bench
+ *
+ * and run it on as many ranks as you want to measure, with machine-readable output:
+ *
+ * mpiexec -n 4 ./petsc_smart_ptr_bench --benchmark_format=json --benchmark_out=bench_output.json
+ *
+ * Only rank 0 reports; the rank count is in the output's context as "mpi_ranks". Every benchmark comes as a
+ * raw_* / handle_* pair doing the same work, so the overhead is the ratio of the two. The ones on
+ * PETSC_COMM_SELF measure the wrapper alone; the ones on PETSC_COMM_WORLD (assembly, destruction) are collective,
+ * so they run a fixed number of iterations to keep the ranks in step.
+ */
+#include "petsc_smart_ptr.hpp"
+#include "petsc_mat_assembler.hpp"
+#include "petsc_vec_expr.hpp"
+#include "petsc_deferred_destroy.hpp"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+
+
+//aborts the run: a benchmark that failed halfway measures nothing useful
+#define BENCH_CHECK(ierr) do {if(ierr) {PetscError(PETSC_COMM_SELF, __LINE__, PETSC_FUNCTION_NAME, __FILE__, ierr, PETSC_ERROR_REPEAT, " "); MPI_Abort(PETSC_COMM_WORLD, ierr);}} while(0)
+
+static constexpr int collective_iterations = 20;
+
+
+//construct/destroy
+
+static void raw_mat_create_destroy(benchmark::State& state)
+{
+	for(auto _ : state)
+	{
+		Mat A;
+		PetscErrorCode ierr = MatCreate(PETSC_COMM_SELF, &A);BENCH_CHECK(ierr);
+		benchmark::DoNotOptimize(A);
+		ierr = MatDestroy(&A);BENCH_CHECK(ierr);
+	}
+}
+BENCHMARK(raw_mat_create_destroy);
+
+template<typename DestroyPolicy>
+static void handle_mat_create_destroy(benchmark::State& state)
+{
+	for(auto _ : state)
+	{
+		petsc_smart_ptr<_p_Mat, DestroyPolicy> A(PETSC_COMM_SELF);
+		Mat a = A.get();
+		benchmark::DoNotOptimize(a);
+	}
+}
+BENCHMARK_TEMPLATE(handle_mat_create_destroy, petsc_fast_destroy);
+BENCHMARK_TEMPLATE(handle_mat_create_destroy, petsc_checked_destroy);
+
+static void raw_vec_create_destroy(benchmark::State& state)
+{
+	for(auto _ : state)
+	{
+		Vec x;
+		PetscErrorCode ierr = VecCreate(PETSC_COMM_SELF, &x);BENCH_CHECK(ierr);
+		benchmark::DoNotOptimize(x);
+		ierr = VecDestroy(&x);BENCH_CHECK(ierr);
+	}
+}
+BENCHMARK(raw_vec_create_destroy);
+
+template<typename DestroyPolicy>
+static void handle_vec_create_destroy(benchmark::State& state)
+{
+	for(auto _ : state)
+	{
+		petsc_smart_ptr<_p_Vec, DestroyPolicy> x(PETSC_COMM_SELF);
+		Vec v = x.get();
+		benchmark::DoNotOptimize(v);
+	}
+}
+BENCHMARK_TEMPLATE(handle_vec_create_destroy, petsc_fast_destroy);
+BENCHMARK_TEMPLATE(handle_vec_create_destroy, petsc_checked_destroy);
+
+
+//copy/move: a copy is a reference taken and dropped, a move should be nothing at all
+
+static void raw_mat_reference(benchmark::State& state)
+{
+	Mat A;
+	PetscErrorCode ierr = MatCreate(PETSC_COMM_SELF, &A);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		Mat B = A;
+		ierr = PetscObjectReference((PetscObject)(B));BENCH_CHECK(ierr);
+		benchmark::DoNotOptimize(B);
+		ierr = MatDestroy(&B);BENCH_CHECK(ierr);
+	}
+	ierr = MatDestroy(&A);BENCH_CHECK(ierr);
+}
+BENCHMARK(raw_mat_reference);
+
+static void handle_mat_copy(benchmark::State& state)
+{
+	petsc_smart_ptr<_p_Mat> A(PETSC_COMM_SELF);
+	for(auto _ : state)
+	{
+		petsc_smart_ptr<_p_Mat> B(A);
+		Mat b = B.get();
+		benchmark::DoNotOptimize(b);
+	}
+}
+BENCHMARK(handle_mat_copy);
+
+static void raw_mat_pointer_copy(benchmark::State& state)
+{
+	Mat A;
+	PetscErrorCode ierr = MatCreate(PETSC_COMM_SELF, &A);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		Mat B = A;
+		benchmark::DoNotOptimize(B);
+		A = B;
+	}
+	ierr = MatDestroy(&A);BENCH_CHECK(ierr);
+}
+BENCHMARK(raw_mat_pointer_copy);
+
+static void handle_mat_move(benchmark::State& state)
+{
+	petsc_smart_ptr<_p_Mat> A(PETSC_COMM_SELF);
+	for(auto _ : state)
+	{
+		petsc_smart_ptr<_p_Mat> B(std::move(A));
+		Mat b = B.get();
+		benchmark::DoNotOptimize(b);
+		A = std::move(B);
+	}
+}
+BENCHMARK(handle_mat_move);
+
+//n handle copies into a growing std::vector: one reference each, and the reallocations in between are all moves
+static void handle_mat_vector_growth(benchmark::State& state)
+{
+	petsc_smart_ptr<_p_Mat> A(PETSC_COMM_SELF);
+	const std::size_t n = static_cast<std::size_t>(state.range(0));
+	for(auto _ : state)
+	{
+		std::vector<petsc_smart_ptr<_p_Mat>> mats;
+		for(std::size_t i = 0; i < n; ++i)
+		{
+			mats.push_back(A);
+		}
+		petsc_smart_ptr<_p_Mat>* data = mats.data();
+		benchmark::DoNotOptimize(data);
+	}
+	state.SetItemsProcessed(state.iterations()*static_cast<int64_t>(n));
+}
+BENCHMARK(handle_mat_vector_growth)->Arg(1 << 10);
+
+
+/* assembly of state.range(0) entries per rank into a preallocated 5-point-band MPIAIJ: one MatSetValues call per
+ * entry vs. the batched assembler
+ */
+static PetscErrorCode create_band_matrix(PetscInt nnz, Mat* A) noexcept
+{
+	PetscFunctionBegin;
+	const PetscInt rows = nnz/5;
+	PetscErrorCode ierr = MatCreate(PETSC_COMM_WORLD, A);CHKERRQ(ierr);
+	ierr = MatSetSizes(*A, rows, rows, PETSC_DETERMINE, PETSC_DETERMINE);CHKERRQ(ierr);
+	ierr = MatSetType(*A, MATAIJ);CHKERRQ(ierr);
+	ierr = MatSeqAIJSetPreallocation(*A, 5, NULL);CHKERRQ(ierr);
+	ierr = MatMPIAIJSetPreallocation(*A, 5, NULL, 2, NULL);CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+//the (row, col) of the k-th local entry: columns row-2 .. row+2, clipped at the global edges
+static void band_entry(PetscInt rstart, PetscInt N, PetscInt k, PetscInt* row, PetscInt* col) noexcept
+{
+	*row = rstart + k/5;
+	*col = *row + k%5 - 2;
+	if(*col < 0 or *col >= N)
+	{
+		*col = *row;
+	}
+}
+
+static void raw_mat_assembly(benchmark::State& state)
+{
+	const PetscInt nnz = static_cast<PetscInt>(state.range(0));
+	Mat A;
+	PetscErrorCode ierr = create_band_matrix(nnz, &A);BENCH_CHECK(ierr);
+	PetscInt rstart, rend, N;
+	ierr = MatGetOwnershipRange(A, &rstart, &rend);BENCH_CHECK(ierr);
+	ierr = MatGetSize(A, &N, NULL);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		for(PetscInt k = 0; k < 5*(rend - rstart); ++k)
+		{
+			PetscInt row, col;
+			band_entry(rstart, N, k, &row, &col);
+			const PetscScalar v = 1;
+			ierr = MatSetValues(A, 1, &row, 1, &col, &v, ADD_VALUES);BENCH_CHECK(ierr);
+		}
+		ierr = MatAssemblyBegin(A, MAT_FINAL_ASSEMBLY);BENCH_CHECK(ierr);
+		ierr = MatAssemblyEnd(A, MAT_FINAL_ASSEMBLY);BENCH_CHECK(ierr);
+	}
+	state.SetItemsProcessed(state.iterations()*static_cast<int64_t>(nnz));
+	ierr = MatDestroy(&A);BENCH_CHECK(ierr);
+}
+BENCHMARK(raw_mat_assembly)->Arg(1000000)->Iterations(collective_iterations)->Unit(benchmark::kMillisecond);
+
+static void handle_mat_assembly(benchmark::State& state)
+{
+	const PetscInt nnz = static_cast<PetscInt>(state.range(0));
+	Mat raw;
+	PetscErrorCode ierr = create_band_matrix(nnz, &raw);BENCH_CHECK(ierr);
+	petsc_smart_ptr<_p_Mat> A(raw, petsc_adopt);
+	PetscInt rstart, rend, N;
+	ierr = MatGetOwnershipRange(A.get(), &rstart, &rend);BENCH_CHECK(ierr);
+	ierr = MatGetSize(A.get(), &N, NULL);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		petsc_mat_assembler assembler(A);
+		for(PetscInt k = 0; k < 5*(rend - rstart); ++k)
+		{
+			PetscInt row, col;
+			band_entry(rstart, N, k, &row, &col);
+			ierr = assembler.add(row, col, 1);BENCH_CHECK(ierr);
+		}
+		ierr = assembler.finish();BENCH_CHECK(ierr);
+	}
+	state.SetItemsProcessed(state.iterations()*static_cast<int64_t>(nnz));
+}
+BENCHMARK(handle_mat_assembly)->Arg(1000000)->Iterations(collective_iterations)->Unit(benchmark::kMillisecond);
+
+
+//w = a*x + b*y + c*z on state.range(0) local entries
+
+static void raw_vec_update(benchmark::State& state)
+{
+	Vec x, y, z, w;
+	PetscErrorCode ierr = VecCreateSeq(PETSC_COMM_SELF, static_cast<PetscInt>(state.range(0)), &x);BENCH_CHECK(ierr);
+	ierr = VecSet(x, 1);BENCH_CHECK(ierr);
+	ierr = VecDuplicate(x, &y);BENCH_CHECK(ierr);
+	ierr = VecDuplicate(x, &z);BENCH_CHECK(ierr);
+	ierr = VecDuplicate(x, &w);BENCH_CHECK(ierr);
+	ierr = VecSet(y, 2);BENCH_CHECK(ierr);
+	ierr = VecSet(z, 3);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		//the same single pass over borrowed arrays that the expression lowers to on host vectors, written out by
+		//hand, so the pair measures the wrapper and not the fusion
+		const PetscScalar *xa, *ya, *za;
+		PetscScalar*       wa;
+		PetscInt           n;
+		ierr = VecGetLocalSize(w, &n);BENCH_CHECK(ierr);
+		ierr = VecGetArrayRead(x, &xa);BENCH_CHECK(ierr);
+		ierr = VecGetArrayRead(y, &ya);BENCH_CHECK(ierr);
+		ierr = VecGetArrayRead(z, &za);BENCH_CHECK(ierr);
+		ierr = VecGetArrayWrite(w, &wa);BENCH_CHECK(ierr);
+		for(PetscInt i = 0; i < n; ++i)
+		{
+			wa[i] = 0.5*xa[i] + 0.25*ya[i] + 0.125*za[i];
+		}
+		ierr = VecRestoreArrayWrite(w, &wa);BENCH_CHECK(ierr);
+		ierr = VecRestoreArrayRead(z, &za);BENCH_CHECK(ierr);
+		ierr = VecRestoreArrayRead(y, &ya);BENCH_CHECK(ierr);
+		ierr = VecRestoreArrayRead(x, &xa);BENCH_CHECK(ierr);
+		ierr = PetscLogFlops(5.0*n);BENCH_CHECK(ierr);
+	}
+	state.SetBytesProcessed(state.iterations()*state.range(0)*4*static_cast<int64_t>(sizeof(PetscScalar)));
+	ierr = VecDestroy(&x);BENCH_CHECK(ierr);
+	ierr = VecDestroy(&y);BENCH_CHECK(ierr);
+	ierr = VecDestroy(&z);BENCH_CHECK(ierr);
+	ierr = VecDestroy(&w);BENCH_CHECK(ierr);
+}
+BENCHMARK(raw_vec_update)->Arg(1 << 20);
+
+static void handle_vec_update(benchmark::State& state)
+{
+	Vec raw;
+	PetscErrorCode ierr = VecCreateSeq(PETSC_COMM_SELF, static_cast<PetscInt>(state.range(0)), &raw);BENCH_CHECK(ierr);
+	petsc_smart_ptr<_p_Vec> x(raw, petsc_adopt), y, z, w;
+	ierr = VecSet(x.get(), 1);BENCH_CHECK(ierr);
+	ierr = x.duplicate(&y);BENCH_CHECK(ierr);
+	ierr = x.duplicate(&z);BENCH_CHECK(ierr);
+	ierr = x.duplicate(&w);BENCH_CHECK(ierr);
+	ierr = VecSet(y.get(), 2);BENCH_CHECK(ierr);
+	ierr = VecSet(z.get(), 3);BENCH_CHECK(ierr);
+	for(auto _ : state)
+	{
+		//one fused pass
+		ierr = w.assign(0.5*x + 0.25*y + 0.125*z);BENCH_CHECK(ierr);
+	}
+	state.SetBytesProcessed(state.iterations()*state.range(0)*4*static_cast<int64_t>(sizeof(PetscScalar)));
+}
+BENCHMARK(handle_vec_update)->Arg(1 << 20);
+
+
+/* tearing down state.range(0) parallel Vecs (e.g. the temporaries of a Newton step), on however many ranks the
+ * run uses: raw VecDestroy vs. the fast and checked policies vs. a deferred destroy with one drain
+ */
+static void make_world_vecs(std::size_t n, std::vector<Vec>* vecs) noexcept
+{
+	vecs->resize(n);
+	for(Vec& v : *vecs)
+	{
+		PetscErrorCode ierr = VecCreateMPI(PETSC_COMM_WORLD, 16, PETSC_DETERMINE, &v);BENCH_CHECK(ierr);
+	}
+}
+
+static void raw_vec_teardown(benchmark::State& state)
+{
+	std::vector<Vec> vecs;
+	for(auto _ : state)
+	{
+		state.PauseTiming();
+		make_world_vecs(static_cast<std::size_t>(state.range(0)), &vecs);
+		state.ResumeTiming();
+		for(Vec& v : vecs)
+		{
+			PetscErrorCode ierr = VecDestroy(&v);BENCH_CHECK(ierr);
+		}
+	}
+	state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+BENCHMARK(raw_vec_teardown)->Arg(1000)->Iterations(collective_iterations);
+
+template<typename DestroyPolicy>
+static void handle_vec_teardown(benchmark::State& state)
+{
+	std::vector<Vec> vecs;
+	std::vector<petsc_smart_ptr<_p_Vec, DestroyPolicy>> handles;
+	for(auto _ : state)
+	{
+		state.PauseTiming();
+		make_world_vecs(static_cast<std::size_t>(state.range(0)), &vecs);
+		for(Vec v : vecs)
+		{
+			handles.emplace_back(v, petsc_adopt);
+		}
+		state.ResumeTiming();
+		handles.clear();
+		//only the deferred policy queues anything; for the others this is one lookup per iteration
+		PetscErrorCode ierr = petsc_destroy_queue::drain(PETSC_COMM_WORLD);BENCH_CHECK(ierr);
+	}
+	state.SetItemsProcessed(state.iterations()*state.range(0));
+}
+BENCHMARK_TEMPLATE(handle_vec_teardown, petsc_fast_destroy)->Arg(1000)->Iterations(collective_iterations);
+BENCHMARK_TEMPLATE(handle_vec_teardown, petsc_checked_destroy)->Arg(1000)->Iterations(collective_iterations);
+BENCHMARK_TEMPLATE(handle_vec_teardown, petsc_deferred_destroy<petsc_fast_destroy>)->Arg(1000)->Iterations(collective_iterations);
+
+
+
+//everybody runs every benchmark (the collective ones need that), only rank 0 reports
+class null_reporter : public benchmark::BenchmarkReporter
+{
+public:
+
+	bool ReportContext(const Context&) override
+	{
+		return true;
+	}
+
+	void ReportRuns(const std::vector<Run>&) override
+	{}
+};
+
+int main(int argc, char** argv)
+{
+	//MPI first, so that the other ranks can drop --benchmark_out (otherwise they'd all truncate rank 0's file)
+	MPI_Init(&argc, &argv);
+	PetscMPIInt rank, size;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	if(rank != 0)
+	{
+		int kept = 0;
+		for(int i = 0; i < argc; ++i)
+		{
+			if(std::string(argv[i]).compare(0, 15, "--benchmark_out") != 0)
+			{
+				argv[kept++] = argv[i];
+			}
+		}
+		argc = kept;
+	}
+	//Google Benchmark takes its --benchmark_* options out of argv, PETSc gets the rest
+	benchmark::Initialize(&argc, argv);
+	PetscErrorCode ierr = PetscInitialize(&argc, &argv, NULL, NULL);
+	if(ierr)
+	{
+		return ierr;
+	}
+	benchmark::AddCustomContext("mpi_ranks", std::to_string(size));
+	if(rank == 0)
+	{
+		benchmark::RunSpecifiedBenchmarks();
+	}
+	else
+	{
+		//no file reporter: without --benchmark_out, Google Benchmark refuses one and exits
+		null_reporter display;
+		benchmark::RunSpecifiedBenchmarks(&display);
+	}
+	benchmark::Shutdown();
+	ierr = PetscFinalize();
+	//PETSc leaves MPI alone if it didn't initialize it
+	MPI_Finalize();
+	return ierr;
+}
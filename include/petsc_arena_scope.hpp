@@ -0,0 +1,382 @@
+#ifndef PETSC_ARENA_SCOPE_HPP
+#define PETSC_ARENA_SCOPE_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+
+
+/* RAII bump allocator for PETSc's own mallocs. While a petsc_arena_scope is alive, every PetscMalloc*() (object
+ * headers, layouts, matrix/vector storage, ...) is carved out of a few big chunks, PetscFree() of those is a
+ * no-op, and the whole lot is released at once when the scope exits:
+ *
+ * for(each nonlinear iteration)
+ * {
+ * 	petsc_arena_scope arena;
+ * 	//short-lived temporaries, all created and destroyed in here
+ * }
+ *
+ * Everything allocated inside the scope should be freed (i.e. every object created in it destroyed) before the
+ * scope exits. Stragglers do happen, PETSc makes long-lived allocations of its own the first time some things are
+ * used (communicator attributes, class and log registration, options), so if something is still live at exit,
+ * that's reported and the chunks are kept for the rest of the run instead of freed. Freeing (or reallocating) a
+ * straggler later still has to find its chunk rather than hand arena memory to the heap's free, so from then on
+ * the free and realloc hooks stay installed, look in those kept chunks, and pass everything else on to the
+ * heap's. Memory from before the scope is freed normally while it's active. Scopes nest (the innermost one wins);
+ * they aren't thread safe, same as PETSc's malloc.
+ *
+ * PetscMallocSet() may only be called once, before PetscInitialize(), and installing hooks is meant to be a
+ * one-time thing, never undone. The scope goes around that contract: it swaps PETSc's PetscTrMalloc/
+ * PetscTrFree/PetscTrRealloc hooks directly (which is all PetscMallocSet() does) and puts the previous ones back
+ * on exit (the free and realloc ones only if there were no stragglers, see above). So memory can be freed by a
+ * different set of hooks than the one that allocated it, which is fine for PETSc's default allocator and its
+ * -malloc_debug one as long as nothing else calls PetscMallocSet() or swaps them while a scope is alive.
+ */
+class petsc_arena_scope
+{
+public:
+
+	using malloc_fn = PetscErrorCode (*)(size_t, PetscBool, int, const char[], const char[], void**);
+	using free_fn = PetscErrorCode (*)(void*, int, const char[], const char[]);
+	using realloc_fn = PetscErrorCode (*)(size_t, int, const char[], const char[], void**);
+
+	//the first chunk is chunk_size bytes, each one after that twice the size of the previous one
+	explicit petsc_arena_scope(std::size_t chunk_size=1 << 20) noexcept :
+		m_chunk_size(chunk_size), m_live(0), m_allocated(0),
+		m_prev(current()), m_prev_malloc(PetscTrMalloc), m_prev_free(PetscTrFree), m_prev_realloc(PetscTrRealloc)
+	{
+		current() = this;
+		PetscTrMalloc = arena_malloc;
+		PetscTrFree = arena_free;
+		PetscTrRealloc = arena_realloc;
+	};
+
+	petsc_arena_scope(const petsc_arena_scope&) = delete;
+	petsc_arena_scope& operator=(const petsc_arena_scope&) = delete;
+
+	~petsc_arena_scope() noexcept
+	{
+		PetscFunctionBegin;
+		PetscTrMalloc = m_prev_malloc;
+		PetscTrFree = m_prev_free;
+		PetscTrRealloc = m_prev_realloc;
+		current() = m_prev;
+
+		if(m_live)
+		{
+			try
+			{
+				kept().insert(kept().end(), m_chunks.begin(), m_chunks.end());
+			}
+			catch(const std::bad_alloc&)
+			{
+				//nowhere to remember them, so their frees will reach the heap: all we can do is say so
+				(void)PetscFPrintf(PETSC_COMM_SELF, PETSC_STDERR, "petsc_arena_scope: couldn't record the leaked arena\n");
+			}
+		}
+		else
+		{
+			for(chunk& c : m_chunks)
+			{
+				std::free(c.begin);
+			}
+		}
+		//leaving the outermost scope with stragglers (now or from an earlier scope) around: keep watching frees.
+		//Inside another scope its arena_free() does that already
+		if(not kept().empty() and m_prev_free != arena_free and m_prev_free != straggler_free)
+		{
+			heap_free() = m_prev_free;
+			heap_realloc() = m_prev_realloc;
+			PetscTrFree = straggler_free;
+			PetscTrRealloc = straggler_realloc;
+		}
+		if(m_live)
+		{
+			PetscErrorCode ierr = PetscFPrintf(PETSC_COMM_SELF, PETSC_STDERR,
+							   "petsc_arena_scope: %zu allocations still live at scope exit, keeping the arena\n",
+							   m_live);CHKERRV(ierr);
+		}
+		PetscFunctionReturnVoid();
+	}
+
+
+	//allocations made in this scope and not freed yet
+	std::size_t live_allocations() const noexcept
+	{
+		return m_live;
+	}
+
+	//total bytes handed out by this scope (frees don't give anything back until exit)
+	std::size_t bytes_allocated() const noexcept
+	{
+		return m_allocated;
+	}
+
+private:
+
+	struct chunk
+	{
+		char* begin;
+		char* end;
+		char* top;//next free byte
+	};
+
+	//every allocation gets one PETSC_MEMALIGN-sized header in front of it holding its size (for realloc)
+	static constexpr std::size_t header_size = PETSC_MEMALIGN;
+
+	static petsc_arena_scope*& current() noexcept
+	{
+		static petsc_arena_scope* scope = NULL;
+		return scope;
+	}
+
+	static std::size_t align(std::size_t n) noexcept
+	{
+		return (n + PETSC_MEMALIGN - 1)/PETSC_MEMALIGN*PETSC_MEMALIGN;
+	}
+
+	bool owns(const void* ptr) const noexcept
+	{
+		const char* p = static_cast<const char*>(ptr);
+		//newest first, since that's where recent allocations (and so most frees) are
+		for(std::size_t i = m_chunks.size(); i-- > 0;)
+		{
+			if(p >= m_chunks[i].begin and p < m_chunks[i].top)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//innermost scope owning ptr, or NULL if it came from the regular heap
+	static petsc_arena_scope* owner(const void* ptr) noexcept
+	{
+		for(petsc_arena_scope* scope = current(); scope; scope = scope->m_prev)
+		{
+			if(scope->owns(ptr))
+			{
+				return scope;
+			}
+		}
+		return NULL;
+	}
+
+	//chunks of scopes that exited with allocations still live, kept until the process ends
+	static std::vector<chunk>& kept() noexcept
+	{
+		static std::vector<chunk> chunks;
+		return chunks;
+	}
+
+	static bool is_kept(const void* ptr) noexcept
+	{
+		const char* p = static_cast<const char*>(ptr);
+		for(const chunk& c : kept())
+		{
+			if(p >= c.begin and p < c.top)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//the heap's free and realloc, underneath the straggler hooks
+	static free_fn& heap_free() noexcept
+	{
+		static free_fn fn = NULL;
+		return fn;
+	}
+
+	static realloc_fn& heap_realloc() noexcept
+	{
+		static realloc_fn fn = NULL;
+		return fn;
+	}
+
+	//whatever was installed before the outermost scope
+	static petsc_arena_scope* outermost() noexcept
+	{
+		petsc_arena_scope* scope = current();
+		while(scope->m_prev)
+		{
+			scope = scope->m_prev;
+		}
+		return scope;
+	}
+
+	PetscErrorCode allocate(std::size_t size, void** result) noexcept
+	{
+		PetscFunctionBeginHot;
+		const std::size_t need = header_size + align(size);
+		if(m_chunks.empty() or static_cast<std::size_t>(m_chunks.back().end - m_chunks.back().top) < need)
+		{
+			std::size_t chunk_size = m_chunks.empty() ? m_chunk_size : 2*static_cast<std::size_t>(m_chunks.back().end - m_chunks.back().begin);
+			if(chunk_size < need)
+			{
+				chunk_size = need;
+			}
+			//malloc is only guaranteed max_align_t alignment, so ask for enough to line the first block up
+			char* mem = static_cast<char*>(std::malloc(chunk_size + PETSC_MEMALIGN));
+			if(not mem)
+			{
+				PetscFunctionReturn(PETSC_ERR_MEM);
+			}
+			try
+			{
+				m_chunks.push_back(chunk{mem, mem + chunk_size + PETSC_MEMALIGN, mem});
+			}
+			catch(const std::bad_alloc&)
+			{
+				std::free(mem);
+				PetscFunctionReturn(PETSC_ERR_MEM);
+			}
+			chunk& c = m_chunks.back();
+			c.top += (PETSC_MEMALIGN - reinterpret_cast<std::uintptr_t>(mem)%PETSC_MEMALIGN)%PETSC_MEMALIGN;
+		}
+		chunk& c = m_chunks.back();
+		std::memcpy(c.top, &size, sizeof(size));
+		*result = c.top + header_size;
+		c.top += need;
+		++m_live;
+		m_allocated += size;
+		PetscFunctionReturn(0);
+	}
+
+	static std::size_t size_of(const void* ptr) noexcept
+	{
+		std::size_t size;
+		std::memcpy(&size, static_cast<const char*>(ptr) - header_size, sizeof(size));
+		return size;
+	}
+
+
+	static PetscErrorCode arena_malloc(size_t size, PetscBool clear, int, const char[], const char[], void** result) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(not size)
+		{
+			*result = NULL;
+			PetscFunctionReturn(0);
+		}
+		PetscErrorCode ierr = current()->allocate(size, result);CHKERRQ(ierr);
+		if(clear)
+		{
+			std::memset(*result, 0, size);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode arena_free(void* ptr, int line, const char func[], const char file[]) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(not ptr)
+		{
+			PetscFunctionReturn(0);
+		}
+		petsc_arena_scope* scope = owner(ptr);
+		if(scope)
+		{
+			//bump allocator: nothing to give back until the scope exits
+			--scope->m_live;
+			PetscFunctionReturn(0);
+		}
+		if(is_kept(ptr))
+		{
+			PetscFunctionReturn(0);
+		}
+		PetscErrorCode ierr = outermost()->m_prev_free(ptr, line, func, file);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode arena_realloc(size_t size, int line, const char func[], const char file[], void** result) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		void* old = *result;
+		petsc_arena_scope* scope = old ? owner(old) : NULL;
+		if(old and not scope and is_kept(old))
+		{
+			ierr = move_kept(size, result);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+		if(old and not scope)
+		{
+			//heap memory stays on the heap
+			ierr = outermost()->m_prev_realloc(size, line, func, file, result);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+		if(not size)
+		{
+			ierr = arena_free(old, line, func, file);CHKERRQ(ierr);
+			*result = NULL;
+			PetscFunctionReturn(0);
+		}
+		ierr = current()->allocate(size, result);CHKERRQ(ierr);
+		if(old)
+		{
+			const std::size_t old_size = size_of(old);
+			std::memcpy(*result, old, old_size < size ? old_size : size);
+			--scope->m_live;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//installed once the outermost scope is gone, if any straggler is still around
+	static PetscErrorCode straggler_free(void* ptr, int line, const char func[], const char file[]) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(not ptr or is_kept(ptr))
+		{
+			PetscFunctionReturn(0);
+		}
+		PetscErrorCode ierr = heap_free()(ptr, line, func, file);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode straggler_realloc(size_t size, int line, const char func[], const char file[], void** result) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		if(*result and is_kept(*result))
+		{
+			ierr = move_kept(size, result);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+		ierr = heap_realloc()(size, line, func, file, result);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//realloc of a straggler: a fresh block from whatever PetscTrMalloc is now, the old one just stays in its chunk
+	static PetscErrorCode move_kept(size_t size, void** result) noexcept
+	{
+		PetscFunctionBeginHot;
+		void* old = *result;
+		*result = NULL;
+		if(size)
+		{
+			PetscErrorCode ierr = PetscTrMalloc(size, PETSC_FALSE, __LINE__, PETSC_FUNCTION_NAME, __FILE__, result);CHKERRQ(ierr);
+			const std::size_t old_size = size_of(old);
+			std::memcpy(*result, old, old_size < size ? old_size : size);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	std::size_t        m_chunk_size;
+	std::size_t        m_live;
+	std::size_t        m_allocated;
+	std::vector<chunk> m_chunks;
+
+	petsc_arena_scope* m_prev;//enclosing scope, if any
+	malloc_fn          m_prev_malloc;
+	free_fn            m_prev_free;
+	realloc_fn         m_prev_realloc;
+};
+
+#endif //PETSC_ARENA_SCOPE_HPP
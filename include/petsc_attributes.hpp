@@ -0,0 +1,389 @@
+#ifndef PETSC_ATTRIBUTES_HPP
+#define PETSC_ATTRIBUTES_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+
+
+/* typed attributes on PETSc objects, for metadata that hot code needs to get at (PetscObjectQuery() and
+ * PetscOptionsGet*() are string lookups every time). An attribute is keyed by a tag type that says what it holds:
+ *
+ * struct element_order { using type = PetscInt; };
+ *
+ * Each tag gets a small integer index the first time it's used, and every object's attributes live in one
+ * petsc_attribute_table, a vector of slots indexed by it, composed with the object. Finding the table is one
+ * PetscObjectQuery(); after that an attribute is a bounds check and a load:
+ *
+ * petsc_attributes attr(A);//the one string lookup
+ * ierr = attr.set<element_order>(2);CHKERRQ(ierr);
+ * for(each element)
+ * 	const PetscInt* p = attr.find<element_order>();//NULL if not set
+ *
+ * The table is on the object, not in the handle (which stays one pointer), so every handle to the object, and
+ * every copy of it, sees the same attributes, and they go when the object does. Small trivially copyable values
+ * (PetscInt, PetscReal, a pointer, ...) live in the slot itself, so setting one doesn't allocate; a pointer to one
+ * is good until the next set() of any tag on the object, which may move the slots.
+ */
+
+
+//index of Tag's slot, the same in every table. Assigned on first use (thread safe)
+struct petsc_attribute_registry
+{
+	static std::size_t next() noexcept
+	{
+		static std::atomic<std::size_t> count(0);
+		return count++;
+	}
+};
+
+template<typename Tag>
+std::size_t petsc_attribute_index() noexcept
+{
+	static const std::size_t index = petsc_attribute_registry::next();
+	return index;
+}
+
+
+class petsc_attribute_table
+{
+public:
+
+	static const char* key() noexcept
+	{
+		return "petsc_smart_ptr_attributes";
+	}
+
+	petsc_attribute_table() noexcept
+	{};
+
+	petsc_attribute_table(const petsc_attribute_table&) = delete;
+	petsc_attribute_table& operator=(const petsc_attribute_table&) = delete;
+
+	~petsc_attribute_table() noexcept
+	{
+		for(slot& s : m_slots)
+		{
+			s.clear();
+		}
+	}
+
+	//obj's table, composing a fresh one with it if it doesn't have one yet
+	static PetscErrorCode of(PetscObject obj, petsc_attribute_table** table) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = find(obj, table);CHKERRQ(ierr);
+		if(*table)
+		{
+			PetscFunctionReturn(0);
+		}
+		std::unique_ptr<petsc_attribute_table> fresh(new (std::nothrow) petsc_attribute_table());
+		if(not fresh)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_MEM, "couldn't allocate an attribute table");
+		}
+		*table = fresh.get();
+		ierr = petsc_attach_owner(obj, std::move(fresh), key());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//obj's table, or NULL if nothing was ever set on it
+	static PetscErrorCode find(PetscObject obj, petsc_attribute_table** table) noexcept
+	{
+		PetscFunctionBegin;
+		*table = NULL;
+		PetscContainer container;
+		PetscErrorCode ierr = PetscObjectQuery(obj, key(), (PetscObject*)(&container));CHKERRQ(ierr);
+		if(container)
+		{
+			void* ptr;
+			ierr = PetscContainerGetPointer(container, &ptr);CHKERRQ(ierr);
+			*table = static_cast<petsc_attribute_table*>(ptr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	//Tag's value, NULL if it isn't set
+	template<typename Tag>
+	typename Tag::type* find() const noexcept
+	{
+		const std::size_t index = petsc_attribute_index<Tag>();
+		if(index >= m_slots.size())
+		{
+			return NULL;
+		}
+		const slot& s = m_slots[index];
+		if(s.local)
+		{
+			return reinterpret_cast<typename Tag::type*>(const_cast<unsigned char*>(s.buffer));
+		}
+		return static_cast<typename Tag::type*>(s.value);
+	}
+
+	//sets (or replaces) Tag's value
+	template<typename Tag, typename V>
+	PetscErrorCode set(V&& value) noexcept
+	{
+		PetscFunctionBegin;
+		using value_type = typename Tag::type;
+		const std::size_t index = petsc_attribute_index<Tag>();
+		try
+		{
+			if(index >= m_slots.size())
+			{
+				m_slots.resize(index + 1);
+			}
+		}
+		catch(...)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscErrorCode ierr = store<value_type>(m_slots[index], std::forward<V>(value), stored_locally<value_type>());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//unsets Tag
+	template<typename Tag>
+	void erase() noexcept
+	{
+		const std::size_t index = petsc_attribute_index<Tag>();
+		if(index < m_slots.size())
+		{
+			m_slots[index].clear();
+		}
+	}
+
+private:
+
+	//a set value is either on the heap (value, freed by destroy) or, if local, a trivially copyable one in buffer,
+	//which needs no destroying and moves with the slot
+	struct slot
+	{
+		slot() noexcept : value(NULL), destroy(NULL), local(false)
+		{};
+
+		void clear() noexcept
+		{
+			if(value)
+			{
+				destroy(value);
+				value = NULL;
+			}
+			local = false;
+		}
+
+		void*                                    value;
+		void                                     (*destroy)(void*);
+		bool                                     local;
+		alignas(std::max_align_t) unsigned char buffer[sizeof(std::max_align_t)];
+	};
+
+	template<typename T>
+	using stored_locally = std::integral_constant<bool, std::is_trivially_copyable<T>::value and
+							   sizeof(T) <= sizeof(slot::buffer) and
+							   alignof(T) <= alignof(std::max_align_t)>;
+
+	template<typename T, typename V>
+	static PetscErrorCode store(slot& s, V&& value, std::true_type) noexcept
+	{
+		PetscFunctionBegin;
+		try
+		{
+			//made first, so a throwing conversion leaves the old value alone
+			const T fresh(std::forward<V>(value));
+			s.clear();
+			std::memcpy(s.buffer, &fresh, sizeof(T));
+			s.local = true;
+		}
+		catch(...)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	template<typename T, typename V>
+	static PetscErrorCode store(slot& s, V&& value, std::false_type) noexcept
+	{
+		PetscFunctionBegin;
+		T* fresh = NULL;
+		try
+		{
+			fresh = new T(std::forward<V>(value));
+		}
+		catch(...)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		s.clear();
+		s.value = fresh;
+		s.destroy = &destroy_value<T>;
+		PetscFunctionReturn(0);
+	}
+
+	template<typename T>
+	static void destroy_value(void* value) noexcept
+	{
+		delete static_cast<T*>(value);
+	}
+
+	std::vector<slot> m_slots;
+};
+
+
+/* an object's attribute table, looked up once. Borrows the object (no reference is taken), so the object has to
+ * outlive it: keep it for a loop, not in some long-lived structure. The table is created if the object doesn't
+ * have one yet; if that fails the view is null and finds nothing.
+ */
+class petsc_attributes
+{
+public:
+
+	explicit petsc_attributes(PetscObject obj) noexcept : m_table(NULL)
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = petsc_attribute_table::of(obj, &m_table);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	template<typename T, typename DestroyPolicy>
+	explicit petsc_attributes(const petsc_smart_ptr<T, DestroyPolicy>& obj) noexcept :
+		petsc_attributes((PetscObject)(obj.get()))
+	{};
+
+	template<typename Tag>
+	typename Tag::type* find() const noexcept
+	{
+		return m_table ? m_table->find<Tag>() : NULL;
+	}
+
+	template<typename Tag, typename V>
+	PetscErrorCode set(V&& value) noexcept
+	{
+		PetscFunctionBegin;
+		if(not m_table)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_NULL, "attributes of a null object (or the lookup failed)");
+		}
+		PetscErrorCode ierr = m_table->set<Tag>(std::forward<V>(value));CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	template<typename Tag>
+	void erase() noexcept
+	{
+		if(m_table)
+		{
+			m_table->erase<Tag>();
+		}
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_table != NULL;
+	}
+
+private:
+
+	petsc_attribute_table* m_table;
+};
+
+
+//one-off access, a lookup each: for setup code. Loops should hold a petsc_attributes
+template<typename Tag, typename T, typename DestroyPolicy, typename V>
+PetscErrorCode petsc_set_attribute(const petsc_smart_ptr<T, DestroyPolicy>& obj, V&& value) noexcept
+{
+	PetscFunctionBegin;
+	petsc_attribute_table* table;
+	PetscErrorCode ierr = petsc_attribute_table::of((PetscObject)(obj.get()), &table);CHKERRQ(ierr);
+	ierr = table->set<Tag>(std::forward<V>(value));CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+//*value is NULL if Tag isn't set
+template<typename Tag, typename T, typename DestroyPolicy>
+PetscErrorCode petsc_get_attribute(const petsc_smart_ptr<T, DestroyPolicy>& obj, typename Tag::type** value) noexcept
+{
+	PetscFunctionBegin;
+	petsc_attribute_table* table;
+	PetscErrorCode ierr = petsc_attribute_table::find((PetscObject)(obj.get()), &table);CHKERRQ(ierr);
+	*value = table ? table->find<Tag>() : NULL;
+	PetscFunctionReturn(0);
+}
+
+
+
+/* an options database value read once: the PetscOptionsGet*() (a search of the database by name) happens on the
+ * first get() and the result is kept, so a loop can ask every iteration. refresh() reads it again, e.g. after
+ * PetscOptionsSetValue(). Works for PetscInt, PetscReal and PetscBool. name, like every option name, starts
+ * with '-'; name and prefix are borrowed, string literals are the usual thing to pass.
+ */
+template<typename T>
+class petsc_cached_option
+{
+public:
+
+	explicit petsc_cached_option(const char name[], const char prefix[]=NULL, PetscOptions options=NULL) noexcept :
+		m_options(options), m_prefix(prefix), m_name(name), m_value(), m_set(PETSC_FALSE), m_read(false)
+	{};
+
+	//*value is left alone if the option isn't set (so it can hold the default going in); set is optional
+	PetscErrorCode get(T* value, PetscBool* set=NULL) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(not m_read)
+		{
+			PetscErrorCode ierr = refresh();CHKERRQ(ierr);
+		}
+		if(m_set)
+		{
+			*value = m_value;
+		}
+		if(set)
+		{
+			*set = m_set;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode refresh() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = read(&m_value);CHKERRQ(ierr);
+		m_read = true;
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	PetscErrorCode read(PetscInt* value) noexcept
+	{
+		return PetscOptionsGetInt(m_options, m_prefix, m_name, value, &m_set);
+	}
+
+	PetscErrorCode read(PetscReal* value) noexcept
+	{
+		return PetscOptionsGetReal(m_options, m_prefix, m_name, value, &m_set);
+	}
+
+	PetscErrorCode read(PetscBool* value) noexcept
+	{
+		return PetscOptionsGetBool(m_options, m_prefix, m_name, value, &m_set);
+	}
+
+	PetscOptions m_options;
+	const char*  m_prefix;
+	const char*  m_name;
+	T            m_value;
+	PetscBool    m_set;
+	bool         m_read;
+};
+
+#endif //PETSC_ATTRIBUTES_HPP
@@ -0,0 +1,228 @@
+#ifndef PETSC_BATCH_HPP
+#define PETSC_BATCH_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <new>
+#include <vector>
+
+
+
+/* many small same-size sequential objects (local problems, element matrices, ...) made in one go, with all
+ * their storage in one slab and one owner for the lot:
+ *
+ * petsc_batch<_p_Mat> locals;
+ * ierr = petsc_batch<_p_Mat>::create_dense(10000, 6, 6, &locals);CHKERRQ(ierr);
+ * for(PetscInt k = 0; k < locals.size(); ++k)
+ * 	ierr = MatMult(locals.get(k), x, y);CHKERRQ(ierr);
+ *
+ * Object k uses values(k), stride() scalars apart, so a batched kernel can also run over data() directly. For
+ * MATSEQAIJ all of them share one nonzero pattern, copied into the slab once: values can change, the pattern
+ * can't (MatSetValues() outside it is an error, MAT_NEW_NONZERO_LOCATION_ERR). PETSc still allocates each object's header (there's no way to hand it one), but there's a single
+ * allocation for all the storage instead of one or more per object, and no preallocation or pattern copies.
+ *
+ * The batch owns the slab and holds a handle to each object. Other handles to an object (copies of
+ * operator[]'s, or KSPs using it) must be gone by the time the batch is, since the storage goes with it.
+ * Move-only.
+ */
+template<typename T, typename DestroyPolicy = petsc_default_destroy>
+class petsc_batch
+{
+public:
+
+	using handle = petsc_smart_ptr<T, DestroyPolicy>;
+	using iterator = typename std::vector<handle>::const_iterator;
+
+	petsc_batch() noexcept : m_slab(NULL), m_values(NULL), m_stride(0)
+	{};
+
+	petsc_batch(const petsc_batch&) = delete;
+	petsc_batch& operator=(const petsc_batch&) = delete;
+
+	petsc_batch(petsc_batch&& batch) noexcept : petsc_batch()
+	{
+		swap(batch);
+	}
+
+	petsc_batch& operator=(petsc_batch&& batch) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = reset();CHKERRABORT(PETSC_COMM_SELF, ierr);
+		swap(batch);
+		PetscFunctionReturn(*this);
+	}
+
+	~petsc_batch() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = reset();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//count m x n MATSEQDENSE matrices, column major with leading dimension m, zeroed
+	static PetscErrorCode create_dense(PetscInt count, PetscInt m, PetscInt n, petsc_batch* batch) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_batch b;
+		PetscErrorCode ierr = b.allocate(count, 0, static_cast<std::size_t>(m)*n);CHKERRQ(ierr);
+		for(PetscInt k = 0; k < count; ++k)
+		{
+			Mat A;
+			ierr = MatCreateSeqDense(PETSC_COMM_SELF, m, n, b.values(k), &A);CHKERRQ(ierr);
+			b.m_objects.emplace_back(A, petsc_adopt);
+		}
+		batch->swap(b);
+		PetscFunctionReturn(0);
+	}
+
+	//count m x n MATSEQAIJ matrices with the CSR pattern (i, j), values zeroed. The pattern is copied, so i and j
+	//don't have to outlive the batch
+	static PetscErrorCode create_aij(PetscInt count, PetscInt m, PetscInt n, petsc_array_view<const PetscInt> i,
+					 petsc_array_view<const PetscInt> j, petsc_batch* batch) noexcept
+	{
+		PetscFunctionBegin;
+		if(i.size() != static_cast<std::size_t>(m) + 1 or static_cast<std::size_t>(i[m]) != j.size())
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "CSR pattern needs m + 1 row pointers and i[m] column indices");
+		}
+		const std::size_t nnz = j.size();
+		petsc_batch b;
+		PetscErrorCode ierr = b.allocate(count, i.size() + nnz, nnz);CHKERRQ(ierr);
+		PetscInt* pattern = reinterpret_cast<PetscInt*>(b.m_slab);
+		std::copy(i.begin(), i.end(), pattern);
+		std::copy(j.begin(), j.end(), pattern + i.size());
+		for(PetscInt k = 0; k < count; ++k)
+		{
+			//every matrix points at the same i and j; PETSc doesn't free (or change) arrays it was given
+			Mat A;
+			ierr = MatCreateSeqAIJWithArrays(PETSC_COMM_SELF, m, n, pattern, pattern + i.size(), b.values(k), &A);CHKERRQ(ierr);
+			b.m_objects.emplace_back(A, petsc_adopt);
+			//a new nonzero would make PETSc move this one matrix off the slab (and values(k) would quietly stop
+			//being its storage), so the fixed pattern is an error rather than a promise
+			ierr = MatSetOption(A, MAT_NEW_NONZERO_LOCATION_ERR, PETSC_TRUE);CHKERRQ(ierr);
+		}
+		batch->swap(b);
+		PetscFunctionReturn(0);
+	}
+
+	//count sequential Vecs of n entries (block size bs), zeroed
+	static PetscErrorCode create(PetscInt count, PetscInt n, petsc_batch* batch, PetscInt bs=1) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_batch b;
+		PetscErrorCode ierr = b.allocate(count, 0, static_cast<std::size_t>(n));CHKERRQ(ierr);
+		for(PetscInt k = 0; k < count; ++k)
+		{
+			Vec v;
+			ierr = VecCreateSeqWithArray(PETSC_COMM_SELF, bs, n, b.values(k), &v);CHKERRQ(ierr);
+			b.m_objects.emplace_back(v, petsc_adopt);
+		}
+		batch->swap(b);
+		PetscFunctionReturn(0);
+	}
+
+
+	//destroys the objects (dropping the batch's references), then frees the slab. The batch is empty afterwards
+	PetscErrorCode reset() noexcept
+	{
+		PetscFunctionBegin;
+		for(handle& h : m_objects)
+		{
+			PetscErrorCode ierr = h.reset();CHKERRQ(ierr);
+		}
+		m_objects.clear();
+		::operator delete(m_slab);
+		m_slab = NULL;
+		m_values = NULL;
+		m_stride = 0;
+		PetscFunctionReturn(0);
+	}
+
+	void swap(petsc_batch& batch) noexcept
+	{
+		m_objects.swap(batch.m_objects);
+		std::swap(m_slab, batch.m_slab);
+		std::swap(m_values, batch.m_values);
+		std::swap(m_stride, batch.m_stride);
+	}
+
+
+	PetscInt size() const noexcept
+	{
+		return static_cast<PetscInt>(m_objects.size());
+	}
+
+	bool empty() const noexcept
+	{
+		return m_objects.empty();
+	}
+
+	const handle& operator[](PetscInt k) const noexcept
+	{
+		return m_objects[k];
+	}
+
+	T* get(PetscInt k) const noexcept
+	{
+		return m_objects[k].get();
+	}
+
+	iterator begin() const noexcept
+	{
+		return m_objects.begin();
+	}
+
+	iterator end() const noexcept
+	{
+		return m_objects.end();
+	}
+
+	//object k's values
+	PetscScalar* values(PetscInt k) const noexcept
+	{
+		return m_values + static_cast<std::size_t>(k)*m_stride;
+	}
+
+	//all of them, object after object
+	PetscScalar* data() const noexcept
+	{
+		return m_values;
+	}
+
+	std::size_t stride() const noexcept
+	{
+		return m_stride;
+	}
+
+private:
+
+	//one slab: index_count PetscInts, then (aligned) count*stride PetscScalars, zeroed
+	PetscErrorCode allocate(PetscInt count, std::size_t index_count, std::size_t stride) noexcept
+	{
+		PetscFunctionBegin;
+		const std::size_t align = alignof(PetscScalar);
+		const std::size_t index_bytes = (index_count*sizeof(PetscInt) + align - 1)/align*align;
+		const std::size_t value_count = static_cast<std::size_t>(count)*stride;
+		try
+		{
+			m_objects.reserve(static_cast<std::size_t>(count));
+			//operator new is aligned for any fundamental type, so rounding the indices up is enough for the values
+			m_slab = static_cast<char*>(::operator new(index_bytes + value_count*sizeof(PetscScalar)));
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		m_values = reinterpret_cast<PetscScalar*>(m_slab + index_bytes);
+		std::fill(m_values, m_values + value_count, PetscScalar(0));
+		m_stride = stride;
+		PetscFunctionReturn(0);
+	}
+
+	std::vector<handle> m_objects;
+	char*               m_slab;
+	PetscScalar*        m_values;
+	std::size_t         m_stride;
+};
+
+#endif //PETSC_BATCH_HPP
@@ -0,0 +1,235 @@
+#ifndef PETSC_BLOCK_KERNELS_HPP
+#define PETSC_BLOCK_KERNELS_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include "petsc_mat_assembler.hpp"
+
+
+
+/* small dense block kernels for BAIJ assembly with a block size known at compile time (3x3, 4x4, 5x5, ...).
+ * Every loop runs over template constants and goes through petsc_unroll, so the compiler sees straight-line code
+ * it can keep in registers and vectorize, and the element matrix is stored in exactly the layout
+ * MatSetValuesBlocked() wants, so inserting it is a single call with no repacking:
+ *
+ * petsc_block_element<5, 8> elem(nodes);//8 nodes, 5 unknowns each
+ * for(each quadrature point)
+ * 	for(I, J)
+ * 		elem.add_product(I, J, w, dF_du[I], dF_du[J]);//elem(I,J) += w*A*B
+ * elem.insert(A.get());//MatSetValuesBlocked, or elem.insert(assembler) to stage it
+ */
+
+
+//calls f(0), ..., f(N-1), unrolled at compile time
+template<PetscInt N>
+struct petsc_unroll
+{
+	template<typename F>
+	static void apply(F&& f) noexcept
+	{
+		petsc_unroll<N - 1>::apply(f);
+		f(N - 1);
+	}
+};
+
+template<>
+struct petsc_unroll<0>
+{
+	template<typename F>
+	static void apply(F&&) noexcept
+	{}
+};
+
+
+//BS x BS dense block, row major
+template<PetscInt BS>
+class petsc_block
+{
+public:
+
+	static_assert(BS > 0, "block size must be positive");
+	static constexpr PetscInt block_size = BS;
+
+	//zeroed
+	petsc_block() noexcept
+	{
+		set_zero();
+	}
+
+	void set_zero() noexcept
+	{
+		petsc_unroll<BS*BS>::apply([this](PetscInt k) { m_a[k] = 0; });
+	}
+
+	PetscScalar& operator()(PetscInt i, PetscInt j) noexcept
+	{
+		return m_a[i*BS + j];
+	}
+
+	const PetscScalar& operator()(PetscInt i, PetscInt j) const noexcept
+	{
+		return m_a[i*BS + j];
+	}
+
+	PetscScalar* data() noexcept
+	{
+		return m_a;
+	}
+
+	const PetscScalar* data() const noexcept
+	{
+		return m_a;
+	}
+
+	//this += alpha*b
+	void add(PetscScalar alpha, const petsc_block& b) noexcept
+	{
+		petsc_unroll<BS*BS>::apply([&](PetscInt k) { m_a[k] += alpha*b.m_a[k]; });
+	}
+
+	//this += alpha*a*b
+	void add_product(PetscScalar alpha, const petsc_block& a, const petsc_block& b) noexcept
+	{
+		petsc_unroll<BS>::apply([&](PetscInt i) {
+			petsc_unroll<BS>::apply([&](PetscInt k) {
+				const PetscScalar aik = alpha*a(i, k);
+				petsc_unroll<BS>::apply([&](PetscInt j) { (*this)(i, j) += aik*b(k, j); });
+			});
+		});
+	}
+
+	//this += alpha*u*v^T
+	void add_outer(PetscScalar alpha, const PetscScalar (&u)[BS], const PetscScalar (&v)[BS]) noexcept
+	{
+		petsc_unroll<BS>::apply([&](PetscInt i) {
+			const PetscScalar aui = alpha*u[i];
+			petsc_unroll<BS>::apply([&](PetscInt j) { (*this)(i, j) += aui*v[j]; });
+		});
+	}
+
+private:
+
+	alignas(PETSC_MEMALIGN) PetscScalar m_a[BS*BS];
+};
+
+
+/* element matrix of NODES x NODES blocks of size BS, plus the element's block (node) indices. The values are
+ * kept as one row-major (NODES*BS) x (NODES*BS) array, which is what MatSetValuesBlocked() takes (with the default
+ * MAT_ROW_ORIENTED).
+ */
+template<PetscInt BS, PetscInt NODES>
+class petsc_block_element
+{
+public:
+
+	static_assert(BS > 0 and NODES > 0, "block size and node count must be positive");
+	static constexpr PetscInt block_size = BS;
+	static constexpr PetscInt nodes = NODES;
+	static constexpr PetscInt ld = NODES*BS;//leading dimension of the value array
+
+	//zeroed, indices all -1 (i.e. ignored by PETSc) until set
+	petsc_block_element() noexcept
+	{
+		petsc_unroll<NODES>::apply([this](PetscInt I) { m_idx[I] = -1; });
+		set_zero();
+	}
+
+	explicit petsc_block_element(const PetscInt (&idx)[NODES]) noexcept
+	{
+		set_indices(idx);
+		set_zero();
+	}
+
+	void set_indices(const PetscInt (&idx)[NODES]) noexcept
+	{
+		petsc_unroll<NODES>::apply([&](PetscInt I) { m_idx[I] = idx[I]; });
+	}
+
+	void set_zero() noexcept
+	{
+		for(PetscInt k = 0; k < ld*ld; ++k)
+		{
+			m_vals[k] = 0;
+		}
+	}
+
+	//entry (i, j) of block (I, J)
+	PetscScalar& operator()(PetscInt I, PetscInt J, PetscInt i, PetscInt j) noexcept
+	{
+		return m_vals[(I*BS + i)*ld + J*BS + j];
+	}
+
+	const PetscScalar& operator()(PetscInt I, PetscInt J, PetscInt i, PetscInt j) const noexcept
+	{
+		return m_vals[(I*BS + i)*ld + J*BS + j];
+	}
+
+	//block (I, J) += alpha*b
+	void add_block(PetscInt I, PetscInt J, PetscScalar alpha, const petsc_block<BS>& b) noexcept
+	{
+		PetscScalar* blk = m_vals + I*BS*ld + J*BS;
+		petsc_unroll<BS>::apply([&](PetscInt i) {
+			petsc_unroll<BS>::apply([&](PetscInt j) { blk[i*ld + j] += alpha*b(i, j); });
+		});
+	}
+
+	//block (I, J) += alpha*a*b, without forming a*b first
+	void add_product(PetscInt I, PetscInt J, PetscScalar alpha, const petsc_block<BS>& a, const petsc_block<BS>& b) noexcept
+	{
+		PetscScalar* blk = m_vals + I*BS*ld + J*BS;
+		petsc_unroll<BS>::apply([&](PetscInt i) {
+			petsc_unroll<BS>::apply([&](PetscInt k) {
+				const PetscScalar aik = alpha*a(i, k);
+				petsc_unroll<BS>::apply([&](PetscInt j) { blk[i*ld + j] += aik*b(k, j); });
+			});
+		});
+	}
+
+	const PetscInt* indices() const noexcept
+	{
+		return m_idx;
+	}
+
+	const PetscScalar* values() const noexcept
+	{
+		return m_vals;
+	}
+
+
+	//one MatSetValuesBlocked() for the whole element
+	PetscErrorCode insert(Mat mat, InsertMode mode=ADD_VALUES) const noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = MatSetValuesBlocked(mat, NODES, m_idx, NODES, m_idx, m_vals, mode);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//stages the element in a batched assembler instead
+	PetscErrorCode insert(petsc_mat_assembler& assembler) const noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = assembler.add_blocked(NODES, m_idx, NODES, m_idx, m_vals);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	PetscInt                            m_idx[NODES];
+	alignas(PETSC_MEMALIGN) PetscScalar m_vals[ld*ld];
+};
+
+
+//errors out if mat's block size isn't BS (e.g. before assembling with petsc_block_element<BS, ...>)
+template<PetscInt BS>
+PetscErrorCode petsc_check_block_size(Mat mat) noexcept
+{
+	PetscFunctionBegin;
+	PetscInt bs;
+	PetscErrorCode ierr = MatGetBlockSize(mat, &bs);CHKERRQ(ierr);
+	if(bs != BS)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_INCOMP, "Mat block size doesn't match the compile-time block size");
+	}
+	PetscFunctionReturn(0);
+}
+
+#endif //PETSC_BLOCK_KERNELS_HPP
@@ -0,0 +1,635 @@
+#ifndef PETSC_COROUTINE_HPP
+#define PETSC_COROUTINE_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include "petsc_pending_scatter.hpp"
+#if not defined(__cpp_impl_coroutine)
+#error "petsc_coroutine.hpp needs C++20 coroutines"
+#endif
+#include <coroutine>
+#include <deque>
+#include <new>
+#include <vector>
+
+
+
+/* C++20 coroutines over PETSc's split-phase operations and raw MPI requests. A step function is written as a
+ * petsc_task coroutine, and co_await on e.g. petsc_co_norm() issues VecNormBegin() and suspends; a
+ * petsc_scheduler runs many such tasks and resumes them as their communication can complete, so the reductions,
+ * scatters and assemblies of several tasks are all in flight at once without a hand-written state machine:
+ *
+ * petsc_task residual_norm(Vec r, PetscReal* norm)
+ * {
+ * 	PetscErrorCode ierr = co_await petsc_co_norm(r, NORM_2, norm);CHKERRCO(ierr);
+ * 	co_return 0;
+ * }
+ *
+ * petsc_scheduler sched;
+ * ierr = sched.spawn(residual_norm(r, &rnorm));CHKERRQ(ierr);
+ * ierr = sched.spawn(residual_norm(z, &znorm));CHKERRQ(ierr);
+ * ierr = sched.run();CHKERRQ(ierr);//one combined reduction for both norms
+ *
+ * Every co_await gives back a PetscErrorCode. Coroutines can't return, so use CHKERRCO() (which co_returns) instead
+ * of CHKERRQ(), and end with co_return 0. Tasks are lazy: nothing runs until the scheduler gets to them.
+ *
+ * PETSc's Begin/End pairs don't expose their MPI requests, so a task waiting on one goes onto the scheduler's
+ * deferred list, and the Ends run once no task is ready: all of the deferred ones, in the order their Begins were
+ * issued, before any MPI request is looked at. By then every task has issued its Begin, so split reductions on the
+ * same communicator get combined into one, and scatters and assemblies overlap each other. Raw MPI requests are
+ * only waited for (MPI_Waitsome) when there's nothing else at all to do.
+ *
+ * Collective Begin/End pairs have to happen in the same order on every rank of their communicator, and with the
+ * same Begins pending at each End (that's what gets combined). The scheduler keeps its part of that deterministic:
+ * which tasks are ready, and the order of the Ends, never depends on timing. Raw requests can't be: they complete
+ * when they complete, differently on each rank. So a task that starts a collective after co_await on a raw
+ * request shouldn't share the communicator with collectives of other tasks in the same run() (give it its own
+ * communicator, or do the request first); otherwise ranks can combine different sets, and hang.
+ *
+ * Single threaded, like PETSc. The scheduler owns its tasks' frames; destroying it with tasks still suspended
+ * destroys them (pending scatters and assemblies are ended, raw requests are left to their owners).
+ */
+
+
+//co_return's the error after pushing a traceback line, i.e. CHKERRQ() for petsc_task coroutines
+#define CHKERRCO(ierr) do {if(PetscUnlikely(ierr)) {PetscError(PETSC_COMM_SELF, __LINE__, PETSC_FUNCTION_NAME, __FILE__, ierr, PETSC_ERROR_REPEAT, " "); co_return ierr;}} while(0)
+
+
+class petsc_scheduler;
+
+//a coroutine returning a PetscErrorCode (with co_return), run by a petsc_scheduler. Move-only, owns its frame
+class petsc_task
+{
+public:
+
+	struct promise_type
+	{
+		petsc_scheduler* scheduler = NULL;
+		PetscErrorCode   result = 0;
+
+		petsc_task get_return_object() noexcept
+		{
+			return petsc_task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		//frames are allocated with nothrow new; a task that couldn't be allocated is empty, and spawning it fails
+		static petsc_task get_return_object_on_allocation_failure() noexcept
+		{
+			return petsc_task();
+		}
+
+		std::suspend_always initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		//the scheduler looks at the result and destroys the frame
+		std::suspend_always final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_value(PetscErrorCode ierr) noexcept
+		{
+			result = ierr;
+		}
+
+		void unhandled_exception() noexcept
+		{
+			result = PETSC_ERR_LIB;
+		}
+	};
+
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	constexpr petsc_task() noexcept : m_handle(NULL)
+	{};
+
+	petsc_task(const petsc_task&) = delete;
+	petsc_task& operator=(const petsc_task&) = delete;
+
+	petsc_task(petsc_task&& task) noexcept : m_handle(task.release())
+	{};
+
+	petsc_task& operator=(petsc_task&& task) noexcept
+	{
+		petsc_task(std::move(task)).swap(*this);
+		return *this;
+	}
+
+	~petsc_task() noexcept
+	{
+		if(m_handle)
+		{
+			m_handle.destroy();
+		}
+	}
+
+	void swap(petsc_task& task) noexcept
+	{
+		std::swap(m_handle, task.m_handle);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return static_cast<bool>(m_handle);
+	}
+
+	//hands over the frame, e.g. to a scheduler
+	handle_type release() noexcept
+	{
+		handle_type h = m_handle;
+		m_handle = NULL;
+		return h;
+	}
+
+private:
+
+	explicit petsc_task(handle_type h) noexcept : m_handle(h)
+	{};
+
+	handle_type m_handle;
+};
+
+
+class petsc_scheduler
+{
+public:
+
+	petsc_scheduler() noexcept : m_tasks(0), m_result(0)
+	{};
+
+	petsc_scheduler(const petsc_scheduler&) = delete;
+	petsc_scheduler& operator=(const petsc_scheduler&) = delete;
+
+	~petsc_scheduler() noexcept
+	{
+		//whatever's left is suspended in one of these
+		for(std::coroutine_handle<> h : m_ready)
+		{
+			h.destroy();
+		}
+		for(std::coroutine_handle<> h : m_deferred)
+		{
+			h.destroy();
+		}
+		for(request_waiter& w : m_waiters)
+		{
+			w.task.destroy();
+		}
+	}
+
+
+	//takes over task; it first runs in the next run()
+	PetscErrorCode spawn(petsc_task&& task) noexcept
+	{
+		PetscFunctionBegin;
+		if(not task)
+		{
+			//its frame couldn't be allocated
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		try
+		{
+			//every task is on at most one list at a time, so with room for all of them, making a task ready
+			//never allocates
+			m_ready.reserve(m_tasks + 1);
+			m_running.reserve(m_tasks + 1);
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		petsc_task::handle_type h = task.release();
+		h.promise().scheduler = this;
+		m_ready.push_back(h);
+		++m_tasks;
+		PetscFunctionReturn(0);
+	}
+
+	//runs until every spawned task has finished. Returns the first nonzero result of a task (the others still run
+	//to completion), or an MPI error, in which case the remaining tasks are left suspended
+	PetscErrorCode run() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr;
+		while(m_tasks)
+		{
+			while(not m_ready.empty())
+			{
+				//tasks made ready by this round run in the next one
+				m_running.swap(m_ready);
+				for(std::coroutine_handle<> h : m_running)
+				{
+					//runs until its next co_await (which puts it on some list) or its co_return
+					h.resume();
+					if(h.done())
+					{
+						finished(h);
+					}
+				}
+				m_running.clear();
+			}
+			if(not m_tasks)
+			{
+				break;
+			}
+
+			if(not m_deferred.empty())
+			{
+				//nothing else can move, so it's time for the Ends: all of them, oldest Begin first, and before
+				//waiting, so what runs next is the same on every rank. m_ready has room for every task
+				m_ready.insert(m_ready.end(), m_deferred.begin(), m_deferred.end());
+				m_deferred.clear();
+				continue;
+			}
+			if(m_requests.empty())
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_WRONGSTATE, "petsc_task suspended on something other than the scheduler's awaitables");
+			}
+			ierr = wait_for_requests();CHKERRQ(ierr);
+		}
+		ierr = m_result;
+		m_result = 0;
+		CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//tasks spawned and not finished yet
+	std::size_t active() const noexcept
+	{
+		return m_tasks;
+	}
+
+
+	//used by the awaitables. Both return false (i.e. don't suspend) if the task couldn't be queued, in which case
+	//the awaitable just completes its operation right away, blocking
+
+	bool defer(std::coroutine_handle<> task) noexcept
+	{
+		try
+		{
+			m_deferred.push_back(task);
+		}
+		catch(const std::bad_alloc&)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	bool wait_request(MPI_Request request, MPI_Status* status, std::coroutine_handle<> task) noexcept
+	{
+		try
+		{
+			m_requests.reserve(m_requests.size() + 1);
+			m_statuses.reserve(m_requests.size() + 1);
+			m_indices.reserve(m_requests.size() + 1);
+			m_waiters.push_back(request_waiter{status, task});
+		}
+		catch(const std::bad_alloc&)
+		{
+			return false;
+		}
+		m_requests.push_back(request);
+		return true;
+	}
+
+private:
+
+	struct request_waiter
+	{
+		MPI_Status*             status;//where the task wants it, or MPI_STATUS_IGNORE
+		std::coroutine_handle<> task;
+	};
+
+	void finished(std::coroutine_handle<> h) noexcept
+	{
+		petsc_task::handle_type task = petsc_task::handle_type::from_address(h.address());
+		if(task.promise().result and not m_result)
+		{
+			m_result = task.promise().result;
+		}
+		task.destroy();
+		--m_tasks;
+	}
+
+	//MPI_Waitsome over the outstanding requests, for when nothing else can run; the tasks whose requests
+	//completed become ready
+	PetscErrorCode wait_for_requests() noexcept
+	{
+		PetscFunctionBegin;
+		if(m_requests.empty())
+		{
+			PetscFunctionReturn(0);
+		}
+		//wait_request() reserved room for everything
+		m_statuses.resize(m_requests.size());
+		m_indices.resize(m_requests.size());
+		PetscMPIInt outcount;
+		PetscMPIInt ierr = MPI_Waitsome(static_cast<PetscMPIInt>(m_requests.size()), m_requests.data(), &outcount,
+						m_indices.data(), m_statuses.data());CHKERRMPI(ierr);
+		if(outcount == MPI_UNDEFINED or outcount == 0)
+		{
+			PetscFunctionReturn(0);
+		}
+		for(PetscMPIInt k = 0; k < outcount; ++k)
+		{
+			request_waiter& w = m_waiters[m_indices[k]];
+			if(w.status != MPI_STATUS_IGNORE)
+			{
+				*w.status = m_statuses[k];
+			}
+			m_ready.push_back(w.task);
+		}
+		//completed requests are MPI_REQUEST_NULL now; drop them and their waiters, keeping the order of the rest
+		std::size_t n = 0;
+		for(std::size_t i = 0; i < m_requests.size(); ++i)
+		{
+			if(m_requests[i] != MPI_REQUEST_NULL)
+			{
+				m_requests[n] = m_requests[i];
+				m_waiters[n] = m_waiters[i];
+				++n;
+			}
+		}
+		m_requests.resize(n);
+		m_waiters.resize(n);
+		PetscFunctionReturn(0);
+	}
+
+	std::size_t                          m_tasks;
+	PetscErrorCode                       m_result;//first task error
+	std::vector<std::coroutine_handle<>> m_ready;
+	std::vector<std::coroutine_handle<>> m_running;//the round being resumed
+	std::deque<std::coroutine_handle<>>  m_deferred;//waiting on a PETSc End
+	std::vector<MPI_Request>             m_requests;
+	std::vector<request_waiter>          m_waiters; //parallel to m_requests
+	std::vector<MPI_Status>              m_statuses;
+	std::vector<PetscMPIInt>             m_indices;
+};
+
+
+/* base of the PETSc split-phase awaitables: Begin is issued when the awaitable is made, the task goes onto the
+ * scheduler's deferred list, and End runs when it's resumed (in end(), supplied by Derived). If the task is
+ * destroyed while suspended, Derived's destructor does the End (with end_pending()), so the operation is never left
+ * dangling. It has to be Derived's: by the time ours runs, the members end() uses are gone.
+ */
+template<typename Derived>
+class petsc_split_phase_awaitable
+{
+public:
+
+	petsc_split_phase_awaitable(const petsc_split_phase_awaitable&) = delete;
+	petsc_split_phase_awaitable& operator=(const petsc_split_phase_awaitable&) = delete;
+
+	//a failed Begin doesn't suspend, it just comes back from co_await
+	bool await_ready() const noexcept
+	{
+		return not m_pending;
+	}
+
+	bool await_suspend(petsc_task::handle_type task) noexcept
+	{
+		return task.promise().scheduler->defer(task);
+	}
+
+	PetscErrorCode await_resume() noexcept
+	{
+		if(not m_pending)
+		{
+			return m_ierr;
+		}
+		return finish();
+	}
+
+protected:
+
+	//Derived's constructor issues Begin and then calls this with its error code
+	petsc_split_phase_awaitable() noexcept : m_ierr(0), m_pending(false)
+	{};
+
+	void begun(PetscErrorCode ierr) noexcept
+	{
+		m_ierr = ierr;
+		m_pending = not ierr;
+	}
+
+	//for Derived's destructor: the End, if it hasn't happened
+	void end_pending() noexcept
+	{
+		PetscFunctionBegin;
+		if(m_pending)
+		{
+			PetscErrorCode ierr = finish();CHKERRV(ierr);
+		}
+		PetscFunctionReturnVoid();
+	}
+
+	~petsc_split_phase_awaitable() noexcept
+	{};
+
+private:
+
+	PetscErrorCode finish() noexcept
+	{
+		m_pending = false;
+		return static_cast<Derived*>(this)->end();
+	}
+
+	PetscErrorCode m_ierr;
+	bool           m_pending;
+};
+
+
+//co_await petsc_co_assembly(A): MatAssemblyBegin now, MatAssemblyEnd when the scheduler gets back to the task
+class petsc_assembly_awaitable : public petsc_split_phase_awaitable<petsc_assembly_awaitable>
+{
+public:
+
+	petsc_assembly_awaitable(Mat mat, MatAssemblyType type) noexcept : m_mat(mat), m_type(type)
+	{
+		begun(MatAssemblyBegin(mat, type));
+	};
+
+	~petsc_assembly_awaitable() noexcept
+	{
+		end_pending();
+	}
+
+	PetscErrorCode end() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MatAssemblyEnd(m_mat, m_type);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	Mat             m_mat;
+	MatAssemblyType m_type;
+};
+
+//co_await petsc_co_norm(x, type, &norm): VecNormBegin now, VecNormEnd (which writes *norm) later
+class petsc_norm_awaitable : public petsc_split_phase_awaitable<petsc_norm_awaitable>
+{
+public:
+
+	petsc_norm_awaitable(Vec x, NormType type, PetscReal* norm) noexcept : m_x(x), m_type(type), m_norm(norm)
+	{
+		begun(VecNormBegin(x, type, norm));
+	};
+
+	~petsc_norm_awaitable() noexcept
+	{
+		end_pending();
+	}
+
+	PetscErrorCode end() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecNormEnd(m_x, m_type, m_norm);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	Vec        m_x;
+	NormType   m_type;
+	PetscReal* m_norm;
+};
+
+//co_await petsc_co_dot(x, y, &dot): VecDotBegin now, VecDotEnd later
+class petsc_dot_awaitable : public petsc_split_phase_awaitable<petsc_dot_awaitable>
+{
+public:
+
+	petsc_dot_awaitable(Vec x, Vec y, PetscScalar* dot) noexcept : m_x(x), m_y(y), m_dot(dot)
+	{
+		begun(VecDotBegin(x, y, dot));
+	};
+
+	~petsc_dot_awaitable() noexcept
+	{
+		end_pending();
+	}
+
+	PetscErrorCode end() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecDotEnd(m_x, m_y, m_dot);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	Vec          m_x;
+	Vec          m_y;
+	PetscScalar* m_dot;
+};
+
+//co_await petsc_co_scatter(...) or petsc_co_ghost_update(...): a petsc_pending_scatter, ended when resumed
+class petsc_scatter_awaitable : public petsc_split_phase_awaitable<petsc_scatter_awaitable>
+{
+public:
+
+	petsc_scatter_awaitable(VecScatter sct, Vec x, Vec y, InsertMode imode, ScatterMode smode) noexcept
+	{
+		begun(petsc_pending_scatter::begin(sct, x, y, imode, smode, &m_pending));
+	};
+
+	petsc_scatter_awaitable(Vec ghosted, InsertMode imode, ScatterMode smode) noexcept
+	{
+		begun(petsc_pending_scatter::ghost_update_begin(ghosted, imode, smode, &m_pending));
+	};
+
+	//m_pending would end itself too, but this keeps the base's bookkeeping straight
+	~petsc_scatter_awaitable() noexcept
+	{
+		end_pending();
+	}
+
+	PetscErrorCode end() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = m_pending.wait();CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	petsc_pending_scatter m_pending;
+};
+
+
+inline petsc_assembly_awaitable petsc_co_assembly(Mat mat, MatAssemblyType type=MAT_FINAL_ASSEMBLY) noexcept
+{
+	return petsc_assembly_awaitable(mat, type);
+}
+
+inline petsc_norm_awaitable petsc_co_norm(Vec x, NormType type, PetscReal* norm) noexcept
+{
+	return petsc_norm_awaitable(x, type, norm);
+}
+
+inline petsc_dot_awaitable petsc_co_dot(Vec x, Vec y, PetscScalar* dot) noexcept
+{
+	return petsc_dot_awaitable(x, y, dot);
+}
+
+inline petsc_scatter_awaitable petsc_co_scatter(VecScatter sct, Vec x, Vec y, InsertMode imode, ScatterMode smode) noexcept
+{
+	return petsc_scatter_awaitable(sct, x, y, imode, smode);
+}
+
+inline petsc_scatter_awaitable petsc_co_ghost_update(Vec ghosted, InsertMode imode, ScatterMode smode) noexcept
+{
+	return petsc_scatter_awaitable(ghosted, imode, smode);
+}
+
+
+/* co_await petsc_co_request(req, &status): suspends until the (already started) request completes, as found by
+ * the scheduler's MPI_Waitsome, which it only calls once no task is ready and no End is pending. The request is
+ * consumed, same as by MPI_Wait().
+ */
+class petsc_request_awaitable
+{
+public:
+
+	explicit petsc_request_awaitable(MPI_Request request, MPI_Status* status=MPI_STATUS_IGNORE) noexcept :
+		m_request(request), m_status(status), m_ierr(0)
+	{};
+
+	bool await_ready() const noexcept
+	{
+		return m_request == MPI_REQUEST_NULL;
+	}
+
+	bool await_suspend(petsc_task::handle_type task) noexcept
+	{
+		if(task.promise().scheduler->wait_request(m_request, m_status, task))
+		{
+			return true;
+		}
+		//couldn't queue it, so just wait for it here
+		m_ierr = MPI_Wait(&m_request, m_status) ? PETSC_ERR_MPI : 0;
+		return false;
+	}
+
+	PetscErrorCode await_resume() const noexcept
+	{
+		return m_ierr;
+	}
+
+private:
+
+	MPI_Request    m_request;
+	MPI_Status*    m_status;
+	PetscErrorCode m_ierr;
+};
+
+inline petsc_request_awaitable petsc_co_request(MPI_Request request, MPI_Status* status=MPI_STATUS_IGNORE) noexcept
+{
+	return petsc_request_awaitable(request, status);
+}
+
+#endif //PETSC_COROUTINE_HPP
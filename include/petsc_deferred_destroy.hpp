@@ -0,0 +1,239 @@
+#ifndef PETSC_DEFERRED_DESTROY_HPP
+#define PETSC_DEFERRED_DESTROY_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <deque>
+#include <new>
+#include <vector>
+
+
+
+/* per-communicator queues of objects waiting to be destroyed. petsc_deferred_destroy handles push their object
+ * here instead of destroying it when they hold the last reference; drain() (or drain_some()) destroys what's
+ * queued at a point of your choosing, e.g. right after a KSPSolve() or at checkpoint time. Objects are
+ * destroyed in the order they were queued, and destroying a parallel object is collective, so every rank of the
+ * communicator has to drain at the same point. Anything still queued is drained in PetscFinalize().
+ *
+ * Queues are keyed by PETSc's inner communicator (the one objects actually live on), so drain(comm) with the
+ * communicator the objects were created on does the right thing. drain_all() (and so PetscFinalize()) goes
+ * through the queues in the order they were made, i.e. by each communicator's first push, not by the
+ * communicators' handle values, which differ from rank to rank. So as long as every rank pushes in the same order,
+ * the collective destroys on different communicators line up. Not thread safe.
+ */
+class petsc_destroy_queue
+{
+public:
+
+	//takes over a reference to obj
+	static PetscErrorCode push(PetscObject obj) noexcept
+	{
+		PetscFunctionBeginHot;
+		MPI_Comm comm;
+		PetscErrorCode ierr = PetscObjectGetComm(obj, &comm);CHKERRQ(ierr);
+		if(not finalize_registered())
+		{
+			ierr = PetscRegisterFinalize(finalize);CHKERRQ(ierr);
+			finalize_registered() = true;
+		}
+		try
+		{
+			queue_list::iterator it = find(comm);
+			if(it == queues().end())
+			{
+				queues().push_back(queue{comm, std::deque<PetscObject>()});
+				it = queues().end() - 1;
+			}
+			it->objects.push_back(obj);
+		}
+		catch(const std::bad_alloc&)
+		{
+			//can't defer it, so destroy it now
+			ierr = PetscObjectDestroy(&obj);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//collective on comm: destroys everything queued on it
+	static PetscErrorCode drain(MPI_Comm comm) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = drain_some(comm, static_cast<std::size_t>(-1));CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//collective on comm: destroys at most max_objects of the oldest queued objects, so the drain can be spread
+	//out between pieces of computation. remaining (optional) is how many are still queued afterwards
+	static PetscErrorCode drain_some(MPI_Comm comm, std::size_t max_objects, std::size_t* remaining=NULL) noexcept
+	{
+		PetscFunctionBegin;
+		MPI_Comm inner;
+		PetscErrorCode ierr = inner_comm(comm, &inner);CHKERRQ(ierr);
+		if(remaining)
+		{
+			*remaining = 0;
+		}
+		queue_list::iterator it = find(inner);
+		if(it == queues().end())
+		{
+			PetscFunctionReturn(0);
+		}
+		ierr = drain_queue(inner, max_objects);CHKERRQ(ierr);
+		it = find(inner);
+		if(it == queues().end())
+		{
+			PetscFunctionReturn(0);
+		}
+		if(remaining)
+		{
+			*remaining = it->objects.size();
+		}
+		if(it->objects.empty())
+		{
+			queues().erase(it);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//destroys everything queued on every communicator (collective on all of them, oldest queue first)
+	static PetscErrorCode drain_all() noexcept
+	{
+		PetscFunctionBegin;
+		//destroying one object can queue others (e.g. handles held in a destroyed object's context), so go until
+		//there's nothing left rather than over a snapshot
+		while(not queues().empty())
+		{
+			MPI_Comm comm = queues().front().comm;
+			PetscErrorCode ierr = drain_queue(comm, static_cast<std::size_t>(-1));CHKERRQ(ierr);
+			queue_list::iterator it = find(comm);
+			if(it != queues().end() and it->objects.empty())
+			{
+				queues().erase(it);
+			}
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//number of objects queued on comm
+	static std::size_t size(MPI_Comm comm) noexcept
+	{
+		MPI_Comm inner;
+		if(inner_comm(comm, &inner))
+		{
+			return 0;
+		}
+		queue_list::iterator it = find(inner);
+		return it == queues().end() ? 0 : it->objects.size();
+	}
+
+private:
+
+	struct queue
+	{
+		MPI_Comm                comm;//inner
+		std::deque<PetscObject> objects;
+	};
+
+	//in the order they were made. There are only ever a few communicators, so a linear search it is
+	using queue_list = std::vector<queue>;
+
+	static queue_list& queues() noexcept
+	{
+		static queue_list q;
+		return q;
+	}
+
+	static queue_list::iterator find(MPI_Comm comm) noexcept
+	{
+		queue_list::iterator it = queues().begin();
+		while(it != queues().end() and it->comm != comm)
+		{
+			++it;
+		}
+		return it;
+	}
+
+	static bool& finalize_registered() noexcept
+	{
+		static bool registered = false;
+		return registered;
+	}
+
+	static PetscErrorCode finalize(void)
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = drain_all();CHKERRQ(ierr);
+		//in case PETSc gets initialized again
+		finalize_registered() = false;
+		PetscFunctionReturn(0);
+	}
+
+	//PetscCommDuplicate() on an inner comm just hands it back, and on a user comm it finds the cached inner
+	//comm; either way it takes a reference, which we give right back
+	static PetscErrorCode inner_comm(MPI_Comm comm, MPI_Comm* inner) noexcept
+	{
+		PetscFunctionBeginHot;
+		MPI_Comm dup;
+		PetscErrorCode ierr = PetscCommDuplicate(comm, &dup, NULL);CHKERRQ(ierr);
+		*inner = dup;
+		ierr = PetscCommDestroy(&dup);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//by communicator rather than by reference: a destroy can push a new queue, which moves the others
+	static PetscErrorCode drain_queue(MPI_Comm comm, std::size_t max_objects) noexcept
+	{
+		PetscFunctionBegin;
+		for(std::size_t n = 0; n < max_objects; ++n)
+		{
+			queue_list::iterator it = find(comm);
+			if(it == queues().end() or it->objects.empty())
+			{
+				break;
+			}
+			PetscObject obj = it->objects.front();
+			it->objects.pop_front();
+			//PetscObjectDestroy() dispatches to the typed destroy
+			PetscErrorCode ierr = PetscObjectDestroy(&obj);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+};
+
+
+/* destroy policy that takes the destroy off the critical path: when a handle holds the last reference, the object
+ * goes onto petsc_destroy_queue instead of being destroyed right there. If somebody else still holds a
+ * reference, dropping ours is just a decrement and happens immediately. Check is the policy whose check() runs
+ * first.
+ */
+template<typename Check = petsc_default_destroy>
+struct petsc_deferred_destroy
+{
+	template<typename T>
+	static PetscErrorCode check(T* ptr) noexcept
+	{
+		return Check::check(ptr);
+	}
+
+	template<typename T, typename Destroy>
+	static PetscErrorCode release(T** ptr, Destroy destroy) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscInt refcnt;
+		PetscErrorCode ierr = PetscObjectGetReference((PetscObject)(*ptr), &refcnt);CHKERRQ(ierr);
+		if(refcnt > 1)
+		{
+			ierr = destroy(ptr);CHKERRQ(ierr);
+		}
+		else
+		{
+			ierr = petsc_destroy_queue::push((PetscObject)(*ptr));CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+};
+
+//e.g. petsc_deferred_ptr<_p_Mat> is a Mat handle whose last release is deferred
+template<typename T>
+using petsc_deferred_ptr = petsc_smart_ptr<T, petsc_deferred_destroy<>>;
+
+#endif //PETSC_DEFERRED_DESTROY_HPP
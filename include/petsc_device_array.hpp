@@ -0,0 +1,419 @@
+#ifndef PETSC_DEVICE_ARRAY_HPP
+#define PETSC_DEVICE_ARRAY_HPP
+
+#include "petsc_smart_ptr.hpp"
+
+
+
+/* RAII guards over Vec and MATSEQAIJ storage wherever it currently lives (host, CUDA, HIP, Kokkos, ...). Unlike
+ * petsc_vec_array, which always hands out host memory (so a CUDA vector gets copied down first), these go
+ * through the *AndMemType() getters: for a device type the pointer is device memory, brought up to date on the
+ * device if need be, and the guard's memtype() says which one it is, so a custom kernel can run on the data in
+ * place:
+ *
+ * petsc_vec_device_array<petsc_vec_device_read_write> arr(x);
+ * if(PetscMemTypeDevice(arr.memtype())) launch_kernel(arr.data(), arr.size());
+ * else                                  host_loop(arr.data(), arr.size());
+ *
+ * Restoring tells PETSc which side was touched, so the host/device sync state stays right: read access leaves
+ * both copies valid, the read-write and write ones mark the copy we got as the only valid one (and write, like
+ * VecGetArrayWrite(), doesn't bother bringing the current values over).
+ *
+ * The guards borrow the object (no reference is taken), so it has to outlive them. If getting the array failed,
+ * the guard is null (and empty).
+ */
+
+
+//access modes for petsc_vec_device_array, same idea as petsc_vec_read_write and friends
+struct petsc_vec_device_read_write
+{
+	using scalar = PetscScalar;
+
+	static PetscErrorCode get(Vec vec, PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return VecGetArrayAndMemType(vec, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecRestoreArrayAndMemType(vec, arr);
+	}
+};
+
+struct petsc_vec_device_read
+{
+	using scalar = const PetscScalar;
+
+	static PetscErrorCode get(Vec vec, const PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return VecGetArrayReadAndMemType(vec, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Vec vec, const PetscScalar** arr) noexcept
+	{
+		return VecRestoreArrayReadAndMemType(vec, arr);
+	}
+};
+
+struct petsc_vec_device_write
+{
+	using scalar = PetscScalar;
+
+	static PetscErrorCode get(Vec vec, PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return VecGetArrayWriteAndMemType(vec, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecRestoreArrayWriteAndMemType(vec, arr);
+	}
+};
+
+
+//a Vec's local array wherever it lives. Only index into it on the side memtype() says
+template<typename Access>
+class petsc_vec_device_array : public petsc_array_view<typename Access::scalar>
+{
+	using petsc_array_view = ::petsc_array_view<typename Access::scalar>;
+	using petsc_array_view::m_data;
+	using petsc_array_view::m_size;
+
+public:
+
+	using access = Access;
+
+	petsc_vec_device_array() noexcept : petsc_array_view(), m_vec(NULL), m_mtype(PETSC_MEMTYPE_HOST)
+	{};
+
+	explicit petsc_vec_device_array(Vec vec) noexcept : petsc_array_view(), m_vec(NULL), m_mtype(PETSC_MEMTYPE_HOST)
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = acquire(vec);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	template<typename DestroyPolicy>
+	explicit petsc_vec_device_array(const petsc_smart_ptr<_p_Vec, DestroyPolicy>& vec) noexcept : petsc_vec_device_array(vec.get())
+	{};
+
+	petsc_vec_device_array(const petsc_vec_device_array&) = delete;
+	petsc_vec_device_array& operator=(const petsc_vec_device_array&) = delete;
+
+	petsc_vec_device_array(petsc_vec_device_array&& arr) noexcept :
+		petsc_array_view(arr.m_data, arr.m_size), m_vec(arr.m_vec), m_mtype(arr.m_mtype)
+	{
+		arr.m_vec = NULL;
+		arr.m_data = NULL;
+		arr.m_size = 0;
+	}
+
+	petsc_vec_device_array& operator=(petsc_vec_device_array&& arr) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(this != std::addressof(arr))
+		{
+			PetscErrorCode ierr = restore();CHKERRABORT(PETSC_COMM_SELF, ierr);
+			std::swap(m_vec, arr.m_vec);
+			std::swap(m_data, arr.m_data);
+			std::swap(m_size, arr.m_size);
+			std::swap(m_mtype, arr.m_mtype);
+		}
+		PetscFunctionReturn(*this);
+	}
+
+	~petsc_vec_device_array() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+	//restores whatever we hold, then gets vec's array
+	PetscErrorCode acquire(Vec vec) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRQ(ierr);
+		petsc_smart_ptr_log::scope<_p_Vec> log(petsc_smart_ptr_log::array, vec);
+		PetscInt n;
+		ierr = VecGetLocalSize(vec, &n);CHKERRQ(ierr);
+		typename Access::scalar* arr;
+		PetscMemType mtype;
+		ierr = Access::get(vec, &arr, &mtype);CHKERRQ(ierr);
+		m_vec = vec;
+		m_data = arr;
+		m_size = static_cast<std::size_t>(n);
+		m_mtype = mtype;
+		PetscFunctionReturn(0);
+	}
+
+	//gives the array back early; the guard is null afterwards
+	PetscErrorCode restore() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_vec)
+		{
+			typename Access::scalar* arr = m_data;
+			PetscErrorCode ierr = Access::restore(m_vec, &arr);CHKERRQ(ierr);
+			m_vec = NULL;
+			m_data = NULL;
+			m_size = 0;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//where data() points (PetscMemTypeHost()/PetscMemTypeDevice() tell the two apart)
+	PetscMemType memtype() const noexcept
+	{
+		return m_mtype;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_vec != NULL;
+	}
+
+private:
+
+	Vec          m_vec;//borrowed
+	PetscMemType m_mtype;
+};
+
+
+/* the CSR structure of a MATSEQAIJ (or a device subtype, e.g. aijcusparse or aijkokkos) wherever it lives, from
+ * MatSeqAIJGetCSRAndMemType(). For a parallel matrix, use it on the blocks from MatMPIAIJGetSeqAIJ(). The row
+ * pointers, column indices and values are read-only here (PETSc has no matching restore to tell it about changes);
+ * the values can be written through petsc_mat_device_values. rows() and nonzeros() are host-side counts, the
+ * arrays are on the side memtype() says.
+ */
+class petsc_mat_device_csr
+{
+public:
+
+	petsc_mat_device_csr() noexcept :
+		m_mat(NULL), m_i(NULL), m_j(NULL), m_a(NULL), m_rows(0), m_nnz(0), m_mtype(PETSC_MEMTYPE_HOST)
+	{};
+
+	explicit petsc_mat_device_csr(Mat mat) noexcept : petsc_mat_device_csr()
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = acquire(mat);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	template<typename DestroyPolicy>
+	explicit petsc_mat_device_csr(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& mat) noexcept : petsc_mat_device_csr(mat.get())
+	{};
+
+	PetscErrorCode acquire(Mat mat) noexcept
+	{
+		PetscFunctionBeginHot;
+		m_mat = NULL;
+		PetscInt n;
+		PetscErrorCode ierr = MatGetLocalSize(mat, &m_rows, &n);CHKERRQ(ierr);
+		ierr = nonzeros_of(mat, &m_nnz);CHKERRQ(ierr);
+		PetscScalar* a;
+		ierr = MatSeqAIJGetCSRAndMemType(mat, &m_i, &m_j, &a, &m_mtype);CHKERRQ(ierr);
+		m_a = a;
+		m_mat = mat;
+		PetscFunctionReturn(0);
+	}
+
+	//rows + 1 entries
+	const PetscInt* row_pointers() const noexcept
+	{
+		return m_i;
+	}
+
+	//nonzeros() entries each
+	const PetscInt* column_indices() const noexcept
+	{
+		return m_j;
+	}
+
+	const PetscScalar* values() const noexcept
+	{
+		return m_a;
+	}
+
+	PetscInt rows() const noexcept
+	{
+		return m_rows;
+	}
+
+	PetscInt nonzeros() const noexcept
+	{
+		return m_nnz;
+	}
+
+	PetscMemType memtype() const noexcept
+	{
+		return m_mtype;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_mat != NULL;
+	}
+
+	//i[rows] without reading i, which may be device memory
+	static PetscErrorCode nonzeros_of(Mat mat, PetscInt* nnz) noexcept
+	{
+		PetscFunctionBeginHot;
+		MatInfo info;
+		PetscErrorCode ierr = MatGetInfo(mat, MAT_LOCAL, &info);CHKERRQ(ierr);
+		*nnz = static_cast<PetscInt>(info.nz_used);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	Mat                m_mat;//borrowed
+	const PetscInt*    m_i;
+	const PetscInt*    m_j;
+	const PetscScalar* m_a;
+	PetscInt           m_rows;
+	PetscInt           m_nnz;
+	PetscMemType       m_mtype;
+};
+
+
+//access modes for petsc_mat_device_values
+struct petsc_mat_device_read_write
+{
+	using scalar = PetscScalar;
+
+	static PetscErrorCode get(Mat mat, PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return MatSeqAIJGetArrayAndMemType(mat, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Mat mat, PetscScalar** arr) noexcept
+	{
+		return MatSeqAIJRestoreArrayAndMemType(mat, arr);
+	}
+};
+
+struct petsc_mat_device_read
+{
+	using scalar = const PetscScalar;
+
+	static PetscErrorCode get(Mat mat, const PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return MatSeqAIJGetArrayReadAndMemType(mat, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Mat mat, const PetscScalar** arr) noexcept
+	{
+		return MatSeqAIJRestoreArrayReadAndMemType(mat, arr);
+	}
+};
+
+struct petsc_mat_device_write
+{
+	using scalar = PetscScalar;
+
+	static PetscErrorCode get(Mat mat, PetscScalar** arr, PetscMemType* mtype) noexcept
+	{
+		return MatSeqAIJGetArrayWriteAndMemType(mat, arr, mtype);
+	}
+
+	static PetscErrorCode restore(Mat mat, PetscScalar** arr) noexcept
+	{
+		return MatSeqAIJRestoreArrayWriteAndMemType(mat, arr);
+	}
+};
+
+
+//the value array of a MATSEQAIJ (or device subtype) wherever it lives, in the order of petsc_mat_device_csr's
+//column indices. Restoring a writable one marks the matrix as changed, same as MatSeqAIJRestoreArray()
+template<typename Access>
+class petsc_mat_device_values : public petsc_array_view<typename Access::scalar>
+{
+	using petsc_array_view = ::petsc_array_view<typename Access::scalar>;
+	using petsc_array_view::m_data;
+	using petsc_array_view::m_size;
+
+public:
+
+	using access = Access;
+
+	petsc_mat_device_values() noexcept : petsc_array_view(), m_mat(NULL), m_mtype(PETSC_MEMTYPE_HOST)
+	{};
+
+	explicit petsc_mat_device_values(Mat mat) noexcept : petsc_array_view(), m_mat(NULL), m_mtype(PETSC_MEMTYPE_HOST)
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = acquire(mat);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	template<typename DestroyPolicy>
+	explicit petsc_mat_device_values(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& mat) noexcept : petsc_mat_device_values(mat.get())
+	{};
+
+	petsc_mat_device_values(const petsc_mat_device_values&) = delete;
+	petsc_mat_device_values& operator=(const petsc_mat_device_values&) = delete;
+
+	petsc_mat_device_values(petsc_mat_device_values&& arr) noexcept :
+		petsc_array_view(arr.m_data, arr.m_size), m_mat(arr.m_mat), m_mtype(arr.m_mtype)
+	{
+		arr.m_mat = NULL;
+		arr.m_data = NULL;
+		arr.m_size = 0;
+	}
+
+	~petsc_mat_device_values() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+	PetscErrorCode acquire(Mat mat) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRQ(ierr);
+		PetscInt nnz;
+		ierr = petsc_mat_device_csr::nonzeros_of(mat, &nnz);CHKERRQ(ierr);
+		typename Access::scalar* arr;
+		PetscMemType mtype;
+		ierr = Access::get(mat, &arr, &mtype);CHKERRQ(ierr);
+		m_mat = mat;
+		m_data = arr;
+		m_size = static_cast<std::size_t>(nnz);
+		m_mtype = mtype;
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode restore() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_mat)
+		{
+			typename Access::scalar* arr = m_data;
+			PetscErrorCode ierr = Access::restore(m_mat, &arr);CHKERRQ(ierr);
+			m_mat = NULL;
+			m_data = NULL;
+			m_size = 0;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	PetscMemType memtype() const noexcept
+	{
+		return m_mtype;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_mat != NULL;
+	}
+
+private:
+
+	Mat          m_mat;//borrowed
+	PetscMemType m_mtype;
+};
+
+#endif //PETSC_DEVICE_ARRAY_HPP
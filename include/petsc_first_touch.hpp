@@ -0,0 +1,340 @@
+#ifndef PETSC_FIRST_TOUCH_HPP
+#define PETSC_FIRST_TOUCH_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(PETSC_HAVE_HWLOC) && !defined(PETSC_SMART_PTR_NO_HWLOC)
+#define PETSC_SMART_PTR_HAVE_HWLOC
+#include <hwloc.h>
+#include <unistd.h>
+#endif
+
+
+
+/* NUMA-aware placement for hybrid MPI+threads runs. Linux puts a page on the NUMA domain of the thread that first
+ * writes it, so storage that one thread zeroes ends up on one socket however the compute loops are threaded later.
+ * Everything here first-touches in parallel instead, each OpenMP thread writing the part it'll work on with
+ * petsc_thread_range()'s split (contiguous, in thread order), so loops that use the same split over the same
+ * range (rows of a Mat, entries of a Vec) find their data local:
+ *
+ * petsc_handle<Vec> x;
+ * ierr = petsc_vec_create_first_touch(comm, n, PETSC_DETERMINE, &x);CHKERRQ(ierr);
+ * #pragma omp parallel
+ * {
+ * 	PetscInt lo, hi;
+ * 	petsc_thread_range(n, &lo, &hi);
+ * 	//work on entries [lo, hi)
+ * }
+ *
+ * With bind, each thread also binds its part to its own domain through hwloc (if PETSc was configured with it),
+ * so pages stay there even if something else touches them first. Either way it only helps if the threads are
+ * pinned (OMP_PROC_BIND, OMP_PLACES). Without OpenMP everything is done by the calling thread.
+ */
+
+
+//[lo, hi) of [0, n) for thread t of nt: contiguous, in thread order, sizes differ by at most one
+inline void petsc_thread_range(PetscInt n, int t, int nt, PetscInt* lo, PetscInt* hi) noexcept
+{
+	*lo = static_cast<PetscInt>(static_cast<PetscInt64>(n)*t/nt);
+	*hi = static_cast<PetscInt>(static_cast<PetscInt64>(n)*(t + 1)/nt);
+}
+
+//same, for the calling thread of the current OpenMP team
+inline void petsc_thread_range(PetscInt n, PetscInt* lo, PetscInt* hi) noexcept
+{
+#if defined(_OPENMP)
+	petsc_thread_range(n, omp_get_thread_num(), omp_get_num_threads(), lo, hi);
+#else
+	petsc_thread_range(n, 0, 1, lo, hi);
+#endif
+}
+
+
+#if defined(PETSC_SMART_PTR_HAVE_HWLOC)
+//the node's topology, loaded once
+class petsc_hwloc_topology
+{
+public:
+
+	static hwloc_topology_t get() noexcept
+	{
+		static petsc_hwloc_topology topology;
+		return topology.m_topo;
+	}
+
+private:
+
+	petsc_hwloc_topology() noexcept : m_topo(NULL)
+	{
+		if(hwloc_topology_init(&m_topo) == 0 and hwloc_topology_load(m_topo) != 0)
+		{
+			hwloc_topology_destroy(m_topo);
+			m_topo = NULL;
+		}
+	};
+
+	~petsc_hwloc_topology() noexcept
+	{
+		if(m_topo)
+		{
+			hwloc_topology_destroy(m_topo);
+		}
+	}
+
+	hwloc_topology_t m_topo;
+};
+#endif
+
+//binds the whole pages in [addr, addr + len) to the NUMA domain the calling thread runs on. Binding works on
+//pages, so the partial ones at either end (shared with the neighbouring thread's range) are left to first touch,
+//and so is everything without hwloc. Called from inside parallel regions, so it doesn't push a traceback: a
+//failure is just PETSC_ERR_LIB, for the caller to report
+inline PetscErrorCode petsc_bind_to_local_domain(void* addr, std::size_t len) noexcept
+{
+#if defined(PETSC_SMART_PTR_HAVE_HWLOC)
+	hwloc_topology_t topo = petsc_hwloc_topology::get();
+	if(not topo)
+	{
+		return PETSC_ERR_LIB;
+	}
+	static const std::uintptr_t page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+	const std::uintptr_t begin = (reinterpret_cast<std::uintptr_t>(addr) + page - 1)/page*page;
+	const std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(addr) + len)/page*page;
+	if(end <= begin)
+	{
+		return 0;
+	}
+	PetscErrorCode ierr = PETSC_ERR_LIB;
+	hwloc_bitmap_t cpus = hwloc_bitmap_alloc();
+	if(cpus and hwloc_get_last_cpu_location(topo, cpus, HWLOC_CPUBIND_THREAD) == 0 and
+	   hwloc_set_area_membind(topo, reinterpret_cast<void*>(begin), end - begin, cpus, HWLOC_MEMBIND_BIND, 0) == 0)
+	{
+		ierr = 0;
+	}
+	hwloc_bitmap_free(cpus);
+	return ierr;
+#else
+	(void)addr;
+	(void)len;
+	return 0;
+#endif
+}
+
+//runs touch(lo, hi), which returns a PetscErrorCode, on every thread with its petsc_thread_range() of [0, n).
+//Nonzero if any of them failed
+template<typename Touch>
+PetscErrorCode petsc_parallel_first_touch(PetscInt n, Touch&& touch) noexcept
+{
+	int failed = 0;
+#if defined(_OPENMP)
+	#pragma omp parallel reduction(max:failed)
+#endif
+	{
+		PetscInt lo, hi;
+		petsc_thread_range(n, &lo, &hi);
+		failed = touch(lo, hi) ? 1 : 0;
+	}
+	return failed ? PETSC_ERR_LIB : 0;
+}
+
+
+/* n PetscScalars (or whatever S is), zeroed in parallel as above. Memory comes from malloc() rather than
+ * PetscMalloc(), since -malloc_debug would have the calling thread fill all of it first. Move-only, so it can be
+ * the owner handed to create_with_array(). A null buffer means allocation failed; if binding failed the buffer is
+ * fine (just placed by first touch alone) and the failure is printed.
+ */
+template<typename S>
+class petsc_numa_buffer
+{
+public:
+
+	petsc_numa_buffer() noexcept : m_data(NULL), m_size(0)
+	{};
+
+	explicit petsc_numa_buffer(PetscInt n, PetscBool bind=PETSC_FALSE) noexcept : m_data(NULL), m_size(0)
+	{
+		if(n <= 0)
+		{
+			return;
+		}
+		m_data = static_cast<S*>(std::malloc(static_cast<std::size_t>(n)*sizeof(S)));
+		if(not m_data)
+		{
+			return;
+		}
+		m_size = n;
+		S* data = m_data;
+		PetscErrorCode ierr = petsc_parallel_first_touch(n, [=](PetscInt lo, PetscInt hi) {
+			PetscErrorCode bind_ierr = bind ? petsc_bind_to_local_domain(data + lo, static_cast<std::size_t>(hi - lo)*sizeof(S)) : 0;
+			for(PetscInt k = lo; k < hi; ++k)
+			{
+				data[k] = S();
+			}
+			return bind_ierr;
+		});
+		if(ierr)
+		{
+			(void)PetscError(PETSC_COMM_SELF, __LINE__, PETSC_FUNCTION_NAME, __FILE__, ierr, PETSC_ERROR_INITIAL,
+					 "couldn't bind the buffer to the threads' NUMA domains");
+		}
+	};
+
+	petsc_numa_buffer(const petsc_numa_buffer&) = delete;
+	petsc_numa_buffer& operator=(const petsc_numa_buffer&) = delete;
+
+	petsc_numa_buffer(petsc_numa_buffer&& buffer) noexcept : m_data(buffer.m_data), m_size(buffer.m_size)
+	{
+		buffer.m_data = NULL;
+		buffer.m_size = 0;
+	}
+
+	petsc_numa_buffer& operator=(petsc_numa_buffer&& buffer) noexcept
+	{
+		std::swap(m_data, buffer.m_data);
+		std::swap(m_size, buffer.m_size);
+		return *this;
+	}
+
+	~petsc_numa_buffer() noexcept
+	{
+		std::free(m_data);
+	}
+
+	S* data() const noexcept
+	{
+		return m_data;
+	}
+
+	PetscInt size() const noexcept
+	{
+		return m_size;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_data != NULL;
+	}
+
+private:
+
+	S*       m_data;
+	PetscInt m_size;
+};
+
+
+//new MPI Vec on comm (n local entries, or PETSC_DECIDE) whose storage is first-touched in parallel. It owns the
+//storage like any other Vec. Note VecDuplicate() of it allocates the usual way, use
+//petsc_vec_duplicate_first_touch() for copies that should be placed too
+template<typename DestroyPolicy>
+PetscErrorCode petsc_vec_create_first_touch(MPI_Comm comm, PetscInt n, PetscInt N, petsc_smart_ptr<_p_Vec, DestroyPolicy>* vec,
+					    PetscBool bind=PETSC_FALSE, PetscInt bs=1) noexcept
+{
+	PetscFunctionBegin;
+	PetscErrorCode ierr = PetscSplitOwnership(comm, &n, &N);CHKERRQ(ierr);
+	petsc_numa_buffer<PetscScalar> storage(n, bind);
+	if(n > 0 and not storage)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_MEM, "couldn't allocate Vec storage");
+	}
+	petsc_array_view<PetscScalar> array(storage.data(), static_cast<std::size_t>(n));
+	ierr = petsc_smart_ptr<_p_Vec, DestroyPolicy>::create_with_array(comm, bs, array, N, vec, std::move(storage));CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+//same layout as x, placed like petsc_vec_create_first_touch() (values are not copied)
+template<typename DestroyPolicy>
+PetscErrorCode petsc_vec_duplicate_first_touch(Vec x, petsc_smart_ptr<_p_Vec, DestroyPolicy>* vec, PetscBool bind=PETSC_FALSE) noexcept
+{
+	PetscFunctionBegin;
+	MPI_Comm comm;
+	PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(x), &comm);CHKERRQ(ierr);
+	PetscInt n, N, bs;
+	ierr = VecGetLocalSize(x, &n);CHKERRQ(ierr);
+	ierr = VecGetSize(x, &N);CHKERRQ(ierr);
+	ierr = VecGetBlockSize(x, &bs);CHKERRQ(ierr);
+	ierr = petsc_vec_create_first_touch(comm, n, N, vec, bind, bs);CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+
+//first-touches the value array of a preallocated (not yet assembled) MATSEQAIJ with nnz[i] nonzeros in row i,
+//each thread writing the rows petsc_thread_range() gives it
+inline PetscErrorCode petsc_seqaij_first_touch(Mat mat, const PetscInt nnz[], PetscBool bind) noexcept
+{
+	PetscFunctionBegin;
+	PetscInt m, n;
+	PetscErrorCode ierr = MatGetLocalSize(mat, &m, &n);CHKERRQ(ierr);
+	//preallocation lays the rows out back to back, nnz[i] slots each
+	std::vector<PetscInt> offsets;
+	try
+	{
+		offsets.resize(static_cast<std::size_t>(m) + 1);
+	}
+	catch(const std::bad_alloc&)
+	{
+		PetscFunctionReturn(PETSC_ERR_MEM);
+	}
+	offsets[0] = 0;
+	for(PetscInt i = 0; i < m; ++i)
+	{
+		offsets[i + 1] = offsets[i] + nnz[i];
+	}
+
+	PetscScalar* a;
+	ierr = MatSeqAIJGetArrayWrite(mat, &a);CHKERRQ(ierr);
+	const PetscInt* off = offsets.data();
+	PetscErrorCode touch_ierr = petsc_parallel_first_touch(m, [=](PetscInt lo, PetscInt hi) {
+		PetscErrorCode bind_ierr = bind ? petsc_bind_to_local_domain(a + off[lo], static_cast<std::size_t>(off[hi] - off[lo])*sizeof(PetscScalar)) : 0;
+		for(PetscInt k = off[lo]; k < off[hi]; ++k)
+		{
+			a[k] = 0;
+		}
+		return bind_ierr;
+	});
+	ierr = MatSeqAIJRestoreArrayWrite(mat, &a);CHKERRQ(ierr);
+	if(touch_ierr)
+	{
+		SETERRQ(PETSC_COMM_SELF, touch_ierr, "couldn't bind the matrix values to the threads' NUMA domains");
+	}
+	PetscFunctionReturn(0);
+}
+
+/* first-touches a MATSEQAIJ or MATMPIAIJ right after it was preallocated with d_nnz/o_nnz (point rows; o_nnz is
+ * ignored for MATSEQAIJ), so the numeric assembly and later SpMV find the values of their rows local. Only the
+ * value arrays are reached (PETSc doesn't expose the column indices before assembly). Other types, including
+ * the device subtypes, are left alone.
+ */
+inline PetscErrorCode petsc_mat_first_touch(Mat mat, const PetscInt d_nnz[], const PetscInt o_nnz[], PetscBool bind=PETSC_FALSE) noexcept
+{
+	PetscFunctionBegin;
+	PetscBool seq, mpi;
+	PetscErrorCode ierr = PetscObjectTypeCompare((PetscObject)(mat), MATSEQAIJ, &seq);CHKERRQ(ierr);
+	ierr = PetscObjectTypeCompare((PetscObject)(mat), MATMPIAIJ, &mpi);CHKERRQ(ierr);
+	if(seq)
+	{
+		ierr = petsc_seqaij_first_touch(mat, d_nnz, bind);CHKERRQ(ierr);
+	}
+	else if(mpi)
+	{
+		Mat diag, offdiag;
+		ierr = MatMPIAIJGetSeqAIJ(mat, &diag, &offdiag, NULL);CHKERRQ(ierr);
+		ierr = petsc_seqaij_first_touch(diag, d_nnz, bind);CHKERRQ(ierr);
+		ierr = petsc_seqaij_first_touch(offdiag, o_nnz, bind);CHKERRQ(ierr);
+	}
+	PetscFunctionReturn(0);
+}
+
+template<typename DestroyPolicy>
+PetscErrorCode petsc_mat_first_touch(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& mat, const PetscInt d_nnz[],
+				     const PetscInt o_nnz[], PetscBool bind=PETSC_FALSE) noexcept
+{
+	return petsc_mat_first_touch(mat.get(), d_nnz, o_nnz, bind);
+}
+
+#endif //PETSC_FIRST_TOUCH_HPP
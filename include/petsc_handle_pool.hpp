@@ -0,0 +1,343 @@
+#ifndef PETSC_HANDLE_POOL_HPP
+#define PETSC_HANDLE_POOL_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <functional>
+#include <map>
+#include <new>
+#include <tuple>
+#include <vector>
+
+
+
+/* per-type hooks for petsc_handle_pool: what counts as "the same layout", how to make a new object with that
+ * layout from a prototype, and how to reset a recycled one
+ */
+template<typename T>
+struct petsc_pool_traits;
+
+template<>
+struct petsc_pool_traits<_p_Vec>
+{
+	struct layout
+	{
+		MPI_Comm    comm;//the object's (inner) communicator, shared by everything created on the same user comm
+		std::string type;
+		PetscInt    n, N, bs;
+
+		bool operator<(const layout& l) const noexcept
+		{
+			if(comm != l.comm)
+			{
+				return std::less<MPI_Comm>()(comm, l.comm);
+			}
+			return std::tie(type, n, N, bs) < std::tie(l.type, l.n, l.N, l.bs);
+		}
+	};
+
+	static PetscErrorCode get_layout(Vec vec, layout* l) noexcept
+	{
+		PetscFunctionBegin;
+		VecType vec_t;
+		PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(vec), &l->comm);CHKERRQ(ierr);
+		ierr = VecGetType(vec, &vec_t);CHKERRQ(ierr);
+		ierr = VecGetLocalSize(vec, &l->n);CHKERRQ(ierr);
+		ierr = VecGetSize(vec, &l->N);CHKERRQ(ierr);
+		ierr = VecGetBlockSize(vec, &l->bs);CHKERRQ(ierr);
+		try
+		{
+			l->type = vec_t ? vec_t : "";
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode duplicate(Vec proto, Vec* vec) noexcept
+	{
+		return VecDuplicate(proto, vec);
+	}
+
+	static PetscErrorCode zero(Vec vec) noexcept
+	{
+		return VecZeroEntries(vec);
+	}
+};
+
+//Mats recycled through one pool should share a nonzero pattern (e.g. copies of one Jacobian): MatZeroEntries()
+//keeps whatever pattern the recycled matrix had
+template<>
+struct petsc_pool_traits<_p_Mat>
+{
+	struct layout
+	{
+		MPI_Comm    comm;
+		std::string type;
+		PetscInt    m, n, M, N, bs;
+
+		bool operator<(const layout& l) const noexcept
+		{
+			if(comm != l.comm)
+			{
+				return std::less<MPI_Comm>()(comm, l.comm);
+			}
+			return std::tie(type, m, n, M, N, bs) < std::tie(l.type, l.m, l.n, l.M, l.N, l.bs);
+		}
+	};
+
+	static PetscErrorCode get_layout(Mat mat, layout* l) noexcept
+	{
+		PetscFunctionBegin;
+		MatType mat_t;
+		PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(mat), &l->comm);CHKERRQ(ierr);
+		ierr = MatGetType(mat, &mat_t);CHKERRQ(ierr);
+		ierr = MatGetLocalSize(mat, &l->m, &l->n);CHKERRQ(ierr);
+		ierr = MatGetSize(mat, &l->M, &l->N);CHKERRQ(ierr);
+		ierr = MatGetBlockSize(mat, &l->bs);CHKERRQ(ierr);
+		try
+		{
+			l->type = mat_t ? mat_t : "";
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode duplicate(Mat proto, Mat* mat) noexcept
+	{
+		return MatDuplicate(proto, MAT_DO_NOT_COPY_VALUES, mat);
+	}
+
+	static PetscErrorCode zero(Mat mat) noexcept
+	{
+		return MatZeroEntries(mat);
+	}
+};
+
+
+template<typename T>
+class petsc_handle_pool;
+
+
+/* handle to an object that came out of a petsc_handle_pool. Copies share the object (PETSc refcount, like
+ * petsc_smart_ptr); when the last one goes away while nobody else (e.g. a KSP) holds a reference either, the
+ * object goes back to the pool's free list instead of being destroyed. The pool has to outlive its handles.
+ */
+template<typename T>
+class petsc_pooled_ptr
+{
+public:
+
+	using type = T;
+
+	constexpr petsc_pooled_ptr() noexcept : m_ptr(), m_pool(NULL)
+	{};
+
+	petsc_pooled_ptr(const petsc_pooled_ptr&) noexcept = default;
+
+	petsc_pooled_ptr(petsc_pooled_ptr&& ptr) noexcept : m_ptr(std::move(ptr.m_ptr)), m_pool(ptr.m_pool)
+	{
+		ptr.m_pool = NULL;
+	}
+
+	//copy-and-swap, so whatever we held goes through the pool too
+	petsc_pooled_ptr& operator=(petsc_pooled_ptr ptr) noexcept
+	{
+		swap(ptr);
+		return *this;
+	}
+
+	~petsc_pooled_ptr() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = reset();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//lets go of the object, recycling it if we were the last one holding it
+	PetscErrorCode reset() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		if(m_ptr and m_pool and m_ptr.refcount() == 1)
+		{
+			ierr = m_pool->recycle(m_ptr.release());CHKERRQ(ierr);
+		}
+		else
+		{
+			ierr = m_ptr.reset();CHKERRQ(ierr);
+		}
+		m_pool = NULL;
+		PetscFunctionReturn(0);
+	}
+
+	void swap(petsc_pooled_ptr& ptr) noexcept
+	{
+		m_ptr.swap(ptr.m_ptr);
+		std::swap(m_pool, ptr.m_pool);
+	}
+
+
+	T* get() const noexcept
+	{
+		return m_ptr.get();
+	}
+
+	T* operator->() const noexcept
+	{
+		return m_ptr.get();
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return static_cast<bool>(m_ptr);
+	}
+
+	//the underlying handle, for anything that wants a petsc_smart_ptr. Copies of it hold a reference, so the
+	//object doesn't get recycled out from under them
+	const petsc_smart_ptr<T>& handle() const noexcept
+	{
+		return m_ptr;
+	}
+
+private:
+
+	friend class petsc_handle_pool<T>;
+
+	petsc_pooled_ptr(T* ptr, petsc_adopt_t, petsc_handle_pool<T>* pool) noexcept : m_ptr(ptr, petsc_adopt), m_pool(pool)
+	{};
+
+	petsc_smart_ptr<T>    m_ptr;
+	petsc_handle_pool<T>* m_pool;
+};
+
+
+/* recycler for same-layout Vecs and Mats, e.g. an integrator's per-step work vectors and Jacobian copies:
+ *
+ * petsc_handle_pool<_p_Vec> pool;
+ * for(each step)
+ * {
+ * 	petsc_pooled_ptr<_p_Vec> work;
+ * 	pool.acquire_like(x, &work);//first time: VecDuplicate(x); after that: a recycled, zeroed Vec
+ * 	...
+ * }//work goes back to the pool here
+ *
+ * Free lists are kept per (communicator, type, local/global sizes, block size), so a hit skips the create,
+ * the type lookup and the PetscLayout setup; all it costs is the zeroing (which can be turned off). At most
+ * max_free objects are kept per layout, the rest are destroyed as usual. Not thread safe.
+ */
+template<typename T>
+class petsc_handle_pool
+{
+public:
+
+	using traits = petsc_pool_traits<T>;
+	using layout = typename traits::layout;
+
+	explicit petsc_handle_pool(std::size_t max_free=16) noexcept : m_max_free(max_free)
+	{};
+
+	petsc_handle_pool(const petsc_handle_pool&) = delete;
+	petsc_handle_pool& operator=(const petsc_handle_pool&) = delete;
+
+	~petsc_handle_pool() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = clear();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//an object with proto's layout (not its values): recycled if there's a free one, duplicated from proto if not
+	template<typename DestroyPolicy>
+	PetscErrorCode acquire_like(const petsc_smart_ptr<T, DestroyPolicy>& proto, petsc_pooled_ptr<T>* obj,
+				    PetscBool zero=PETSC_TRUE) noexcept
+	{
+		PetscFunctionBeginHot;
+		layout l;
+		PetscErrorCode ierr = traits::get_layout(proto.get(), &l);CHKERRQ(ierr);
+		T* ptr = NULL;
+		typename free_lists::iterator it = m_free.find(l);
+		if(it != m_free.end() and not it->second.empty())
+		{
+			ptr = it->second.back();
+			it->second.pop_back();
+			if(zero)
+			{
+				ierr = traits::zero(ptr);CHKERRQ(ierr);
+			}
+		}
+		else
+		{
+			ierr = traits::duplicate(proto.get(), &ptr);CHKERRQ(ierr);
+		}
+		*obj = petsc_pooled_ptr<T>(ptr, petsc_adopt, this);
+		PetscFunctionReturn(0);
+	}
+
+	//destroys every free object
+	PetscErrorCode clear() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr;
+		for(auto& free_list : m_free)
+		{
+			for(T* ptr : free_list.second)
+			{
+				ierr = petsc_smart_ptr<T>::destroy_object(&ptr);CHKERRQ(ierr);
+			}
+		}
+		m_free.clear();
+		PetscFunctionReturn(0);
+	}
+
+	std::size_t free_count() const noexcept
+	{
+		std::size_t n = 0;
+		for(const auto& free_list : m_free)
+		{
+			n += free_list.second.size();
+		}
+		return n;
+	}
+
+private:
+
+	friend class petsc_pooled_ptr<T>;
+
+	using free_lists = std::map<layout, std::vector<T*>>;
+
+	//takes over the last reference to ptr
+	PetscErrorCode recycle(T* ptr) noexcept
+	{
+		PetscFunctionBeginHot;
+		layout l;
+		PetscErrorCode ierr = traits::get_layout(ptr, &l);CHKERRQ(ierr);
+		try
+		{
+			std::vector<T*>& free_list = m_free[l];
+			if(free_list.size() < m_max_free)
+			{
+				free_list.push_back(ptr);
+				PetscFunctionReturn(0);
+			}
+		}
+		catch(const std::bad_alloc&)
+		{
+			//no room to keep it around, so just destroy it
+		}
+		ierr = petsc_smart_ptr<T>::destroy_object(&ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	std::size_t m_max_free;
+	free_lists  m_free;
+};
+
+#endif //PETSC_HANDLE_POOL_HPP
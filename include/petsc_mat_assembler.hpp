@@ -0,0 +1,272 @@
+#ifndef PETSC_MAT_ASSEMBLER_HPP
+#define PETSC_MAT_ASSEMBLER_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <algorithm>
+#include <new>
+#include <vector>
+
+
+
+/* batched, RAII-scoped MatSetValues. Entries are staged in contiguous buffers and handed to PETSc in batches
+ * once flush_threshold values are staged (or on flush()), and the destructor flushes and does
+ * MatAssemblyBegin/End. E.g.
+ *
+ * {
+ * 	petsc_mat_assembler assembler(A);
+ * 	for(...) assembler.add(row, col, value);
+ * }//A is assembled here
+ *
+ * Single (row, col, value) entries are sorted by row at flush time, so they go in as one 1 x k MatSetValues call
+ * per distinct row instead of one call per entry. Element blocks are copied into the staging arena as they are
+ * and go in as one MatSetValues (or MatSetValuesBlocked) call each. A bigger flush_threshold trades memory for
+ * fewer calls.
+ *
+ * With INSERT_VALUES the last value set for an entry wins, same as calling MatSetValues directly: the sort is
+ * stable, and a block staged after single entries flushes them first (so single entries between blocks cost a
+ * flush each; batch them). With ADD_VALUES order doesn't matter and nothing extra is flushed.
+ *
+ * The assembler borrows the Mat (no reference is taken), so the Mat has to outlive it. finish() does the flush and
+ * assembly early and reports errors; the destructor can only print them.
+ */
+class petsc_mat_assembler
+{
+public:
+
+	static constexpr std::size_t default_flush_threshold = 1 << 16;
+
+	explicit petsc_mat_assembler(Mat mat, std::size_t flush_threshold=default_flush_threshold,
+				     InsertMode mode=ADD_VALUES, MatAssemblyType assembly_t=MAT_FINAL_ASSEMBLY) noexcept :
+		m_mat(mat), m_threshold(flush_threshold), m_mode(mode), m_assembly_t(assembly_t), m_staged(0)
+	{};
+
+	template<typename DestroyPolicy>
+	explicit petsc_mat_assembler(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& mat,
+				     std::size_t flush_threshold=default_flush_threshold,
+				     InsertMode mode=ADD_VALUES, MatAssemblyType assembly_t=MAT_FINAL_ASSEMBLY) noexcept :
+		petsc_mat_assembler(mat.get(), flush_threshold, mode, assembly_t)
+	{};
+
+	petsc_mat_assembler(const petsc_mat_assembler&) = delete;
+	petsc_mat_assembler& operator=(const petsc_mat_assembler&) = delete;
+
+	petsc_mat_assembler(petsc_mat_assembler&& assembler) noexcept :
+		m_mat(assembler.m_mat), m_threshold(assembler.m_threshold), m_mode(assembler.m_mode),
+		m_assembly_t(assembler.m_assembly_t), m_staged(assembler.m_staged),
+		m_entries(std::move(assembler.m_entries)), m_blocks(std::move(assembler.m_blocks)),
+		m_idx(std::move(assembler.m_idx)), m_vals(std::move(assembler.m_vals))
+	{
+		//the moved-from assembler neither flushes nor assembles
+		assembler.m_mat = NULL;
+	}
+
+	~petsc_mat_assembler() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = finish();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//stages a single entry
+	PetscErrorCode add(PetscInt row, PetscInt col, PetscScalar value) noexcept
+	{
+		PetscFunctionBeginHot;
+		try
+		{
+			m_entries.push_back(entry{row, col, value});
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscErrorCode ierr = staged(1);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//stages a dense m x n element block (row-major, like MatSetValues)
+	PetscErrorCode add(PetscInt m, const PetscInt rows[], PetscInt n, const PetscInt cols[],
+			   const PetscScalar vals[]) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = stage_block(m, rows, n, cols, vals, m*n, PETSC_FALSE);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//stages an m x n block of bs x bs blocks (block indices, like MatSetValuesBlocked)
+	PetscErrorCode add_blocked(PetscInt m, const PetscInt rows[], PetscInt n, const PetscInt cols[],
+				   const PetscScalar vals[]) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscInt bs;
+		PetscErrorCode ierr = MatGetBlockSize(m_mat, &bs);CHKERRQ(ierr);
+		ierr = stage_block(m, rows, n, cols, vals, m*n*bs*bs, PETSC_TRUE);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	//hands everything staged so far to PETSc. The staging buffers keep their capacity for the next batch
+	PetscErrorCode flush() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr;
+		if(not m_mat)
+		{
+			PetscFunctionReturn(0);
+		}
+		petsc_smart_ptr_log::scope<_p_Mat> log(petsc_smart_ptr_log::flush, m_mat);
+
+		for(const block& blk : m_blocks)
+		{
+			const PetscInt* rows = m_idx.data() + blk.idx;
+			if(blk.blocked)
+			{
+				ierr = MatSetValuesBlocked(m_mat, blk.m, rows, blk.n, rows + blk.m, m_vals.data() + blk.val,
+							   m_mode);CHKERRQ(ierr);
+			}
+			else
+			{
+				ierr = MatSetValues(m_mat, blk.m, rows, blk.n, rows + blk.m, m_vals.data() + blk.val,
+						    m_mode);CHKERRQ(ierr);
+			}
+		}
+		m_blocks.clear();
+		m_idx.clear();
+		m_vals.clear();
+
+		if(not m_entries.empty())
+		{
+			std::stable_sort(m_entries.begin(), m_entries.end(),
+					 [](const entry& a, const entry& b) { return a.row < b.row; });
+			//reuse the (now empty) index/value arenas as the column/value scratch for each row
+			try
+			{
+				m_idx.reserve(m_entries.size());
+				m_vals.reserve(m_entries.size());
+			}
+			catch(const std::bad_alloc&)
+			{
+				PetscFunctionReturn(PETSC_ERR_MEM);
+			}
+			for(std::size_t begin = 0, end; begin < m_entries.size(); begin = end)
+			{
+				const PetscInt row = m_entries[begin].row;
+				for(end = begin; end < m_entries.size() and m_entries[end].row == row; ++end)
+				{
+					m_idx.push_back(m_entries[end].col);
+					m_vals.push_back(m_entries[end].value);
+				}
+				ierr = MatSetValues(m_mat, 1, &row, static_cast<PetscInt>(end - begin), m_idx.data(),
+						    m_vals.data(), m_mode);CHKERRQ(ierr);
+				m_idx.clear();
+				m_vals.clear();
+			}
+			m_entries.clear();
+		}
+
+		m_staged = 0;
+		PetscFunctionReturn(0);
+	}
+
+	//flushes, then MatAssemblyBegin/End. The assembler is done afterwards (and the dtor does nothing)
+	PetscErrorCode finish() noexcept
+	{
+		PetscFunctionBegin;
+		if(m_mat)
+		{
+			PetscErrorCode ierr = flush();CHKERRQ(ierr);
+			Mat mat = m_mat;
+			m_mat = NULL;
+			ierr = MatAssemblyBegin(mat, m_assembly_t);CHKERRQ(ierr);
+			ierr = MatAssemblyEnd(mat, m_assembly_t);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	std::size_t flush_threshold() const noexcept
+	{
+		return m_threshold;
+	}
+
+	void set_flush_threshold(std::size_t flush_threshold) noexcept
+	{
+		m_threshold = flush_threshold;
+	}
+
+	//number of values staged but not yet handed to PETSc
+	std::size_t staged() const noexcept
+	{
+		return m_staged;
+	}
+
+private:
+
+	struct entry
+	{
+		PetscInt    row;
+		PetscInt    col;
+		PetscScalar value;
+	};
+
+	//an element block in the arenas: m row indices followed by n column indices at m_idx[idx], values at m_vals[val]
+	struct block
+	{
+		PetscInt    m;
+		PetscInt    n;
+		std::size_t idx;
+		std::size_t val;
+		PetscBool   blocked;
+	};
+
+	PetscErrorCode stage_block(PetscInt m, const PetscInt rows[], PetscInt n, const PetscInt cols[],
+				   const PetscScalar vals[], PetscInt nvals, PetscBool blocked) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		//flush() does blocks before single entries, so for that to be the order they came in, no block may be
+		//staged after single entries
+		if(m_mode == INSERT_VALUES and not m_entries.empty())
+		{
+			ierr = flush();CHKERRQ(ierr);
+		}
+		try
+		{
+			m_blocks.push_back(block{m, n, m_idx.size(), m_vals.size(), blocked});
+			m_idx.insert(m_idx.end(), rows, rows + m);
+			m_idx.insert(m_idx.end(), cols, cols + n);
+			m_vals.insert(m_vals.end(), vals, vals + nvals);
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		ierr = staged(static_cast<std::size_t>(nvals));CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode staged(std::size_t nvals) noexcept
+	{
+		PetscFunctionBeginHot;
+		m_staged += nvals;
+		if(m_staged >= m_threshold)
+		{
+			PetscErrorCode ierr = flush();CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	Mat             m_mat;//borrowed
+	std::size_t     m_threshold;
+	InsertMode      m_mode;
+	MatAssemblyType m_assembly_t;
+	std::size_t     m_staged;
+
+	std::vector<entry>       m_entries;
+	std::vector<block>       m_blocks;
+	std::vector<PetscInt>    m_idx;
+	std::vector<PetscScalar> m_vals;
+};
+
+#endif //PETSC_MAT_ASSEMBLER_HPP
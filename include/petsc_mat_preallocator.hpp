@@ -0,0 +1,311 @@
+#ifndef PETSC_MAT_PREALLOCATOR_HPP
+#define PETSC_MAT_PREALLOCATOR_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include "petsc_first_touch.hpp"
+#include <algorithm>
+#include <new>
+#include <vector>
+
+
+
+/* two-pass preallocation. The symbolic pass feeds the nonzero pattern into a petsc_mat_preallocator,
+ * preallocate() turns it into exact d_nnz/o_nnz (per block row, if the block size is > 1) and calls
+ * MatXAIJSetPreallocation(), and the numeric pass then assembles with no mallocs. The add() overloads match
+ * petsc_mat_assembler's, values are ignored, so the same element loop can drive both passes:
+ *
+ * template<typename Sink> PetscErrorCode assemble(Sink& sink);
+ *
+ * petsc_mat_preallocator prealloc(A);
+ * assemble(prealloc);
+ * prealloc.preallocate();
+ * {
+ * 	petsc_mat_assembler assembler(A);
+ * 	assemble(assembler);
+ * }
+ * petsc_mat_preallocator::check_mallocs(A.get());
+ *
+ * The pattern is kept as (block row, block col) pairs in one flat buffer; every so often it's sorted and
+ * deduplicated in place, so memory stays proportional to the number of distinct nonzeros (plus the duplicates seen
+ * since the last compaction) without any per-row allocations. Entries in rows owned by other ranks are shipped
+ * to their owners in preallocate(), which is therefore collective on the Mat's communicator. Like MatSetValues,
+ * negative indices are ignored.
+ *
+ * The Mat's sizes (and block size) have to be set before the preallocator is made. It borrows the Mat, so the Mat
+ * has to outlive it.
+ */
+class petsc_mat_preallocator
+{
+public:
+
+	explicit petsc_mat_preallocator(Mat mat) noexcept :
+		m_mat(mat), m_bs(1), m_rstart(0), m_rend(0), m_cstart(0), m_cend(0), m_compacted(0)
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = setup();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	template<typename DestroyPolicy>
+	explicit petsc_mat_preallocator(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& mat) noexcept :
+		petsc_mat_preallocator(mat.get())
+	{};
+
+
+	//records a single nonzero (point indices)
+	PetscErrorCode add(PetscInt row, PetscInt col, PetscScalar=0) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(row < 0 or col < 0)
+		{
+			PetscFunctionReturn(0);
+		}
+		PetscErrorCode ierr = record(row/m_bs, col/m_bs);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//records a dense m x n element block (point indices)
+	PetscErrorCode add(PetscInt m, const PetscInt rows[], PetscInt n, const PetscInt cols[],
+			   const PetscScalar[]=NULL) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		for(PetscInt i = 0; i < m; ++i)
+		{
+			for(PetscInt j = 0; j < n; ++j)
+			{
+				ierr = add(rows[i], cols[j]);CHKERRQ(ierr);
+			}
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//records an m x n block of bs x bs blocks (block indices, like MatSetValuesBlocked)
+	PetscErrorCode add_blocked(PetscInt m, const PetscInt rows[], PetscInt n, const PetscInt cols[],
+				   const PetscScalar[]=NULL) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		for(PetscInt i = 0; i < m; ++i)
+		{
+			for(PetscInt j = 0; j < n; ++j)
+			{
+				if(rows[i] >= 0 and cols[j] >= 0)
+				{
+					ierr = record(rows[i], cols[j]);CHKERRQ(ierr);
+				}
+			}
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	/* collective. Sends off-process entries to their owners, counts the diagonal/off-diagonal block nonzeros of
+	 * every local (block) row and preallocates with them. Explicit preallocation already makes PETSc treat an
+	 * entry outside the recorded pattern as an error by default; error_on_malloc sets that explicitly, and
+	 * without it MAT_NEW_NONZERO_ALLOCATION_ERR is left as it was (turn it off yourself to allow the mallocs).
+	 * With first_touch, a MATSEQAIJ or
+	 * MATMPIAIJ (block size 1) also has its values first-touched in parallel, see petsc_mat_first_touch() (bind is
+	 * passed on to it). The recorded pattern is freed.
+	 */
+	PetscErrorCode preallocate(PetscBool error_on_malloc=PETSC_FALSE, PetscBool first_touch=PETSC_FALSE,
+				   PetscBool bind=PETSC_FALSE) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = exchange();CHKERRQ(ierr);
+		ierr = compact();CHKERRQ(ierr);
+
+		const PetscInt nrows = (m_rend - m_rstart)/m_bs;
+		const PetscInt cstart = m_cstart/m_bs, cend = m_cend/m_bs;
+		std::vector<PetscInt> nnz;
+		try
+		{
+			nnz.assign(4*static_cast<std::size_t>(nrows), 0);
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		//d_nnz, o_nnz, and the upper-triangular counts SBAIJ wants
+		PetscInt* d_nnz = nnz.data();
+		PetscInt* o_nnz = d_nnz + nrows;
+		PetscInt* d_nnzu = o_nnz + nrows;
+		PetscInt* o_nnzu = d_nnzu + nrows;
+		for(const entry& e : m_pattern)
+		{
+			const PetscInt lrow = e.row - m_rstart/m_bs;
+			const bool upper = e.col >= e.row;
+			if(e.col >= cstart and e.col < cend)
+			{
+				++d_nnz[lrow];
+				d_nnzu[lrow] += upper;
+			}
+			else
+			{
+				++o_nnz[lrow];
+				o_nnzu[lrow] += upper;
+			}
+		}
+		std::vector<entry>().swap(m_pattern);
+		m_compacted = 0;
+
+		ierr = MatXAIJSetPreallocation(m_mat, m_bs, d_nnz, o_nnz, d_nnzu, o_nnzu);CHKERRQ(ierr);
+		if(first_touch and m_bs == 1)
+		{
+			ierr = petsc_mat_first_touch(m_mat, d_nnz, o_nnz, bind);CHKERRQ(ierr);
+		}
+		if(error_on_malloc)
+		{
+			ierr = MatSetOption(m_mat, MAT_NEW_NONZERO_ALLOCATION_ERR, PETSC_TRUE);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	//after assembly: warns (on stderr of the rank in question) if assembling mat needed any mallocs, i.e. the
+	//preallocation was short. had_mallocs is optional
+	static PetscErrorCode check_mallocs(Mat mat, PetscBool* had_mallocs=NULL) noexcept
+	{
+		PetscFunctionBegin;
+		MatInfo info;
+		PetscErrorCode ierr = MatGetInfo(mat, MAT_LOCAL, &info);CHKERRQ(ierr);
+		if(info.mallocs > 0)
+		{
+			ierr = PetscFPrintf(PETSC_COMM_SELF, PETSC_STDERR,
+					    "Warning: assembling the matrix took %g mallocs, the preallocation is too small\n",
+					    (double)info.mallocs);CHKERRQ(ierr);
+		}
+		if(had_mallocs)
+		{
+			*had_mallocs = info.mallocs > 0 ? PETSC_TRUE : PETSC_FALSE;
+		}
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	struct entry
+	{
+		PetscInt row;//block row
+		PetscInt col;//block col
+
+		bool operator<(const entry& e) const noexcept
+		{
+			return row < e.row or (row == e.row and col < e.col);
+		}
+
+		bool operator==(const entry& e) const noexcept
+		{
+			return row == e.row and col == e.col;
+		}
+	};
+
+	//the row/column ownership ranges only exist once the layouts are set up
+	PetscErrorCode setup() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MatGetBlockSize(m_mat, &m_bs);CHKERRQ(ierr);
+		ierr = PetscLayoutSetUp(m_mat->rmap);CHKERRQ(ierr);
+		ierr = PetscLayoutSetUp(m_mat->cmap);CHKERRQ(ierr);
+		ierr = PetscLayoutGetRange(m_mat->rmap, &m_rstart, &m_rend);CHKERRQ(ierr);
+		ierr = PetscLayoutGetRange(m_mat->cmap, &m_cstart, &m_cend);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode record(PetscInt row, PetscInt col) noexcept
+	{
+		PetscFunctionBeginHot;
+		try
+		{
+			m_pattern.push_back(entry{row, col});
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		//amortized: only compact once the duplicates at least match what's already unique
+		if(m_pattern.size() >= std::max<std::size_t>(2*m_compacted, 1 << 16))
+		{
+			PetscErrorCode ierr = compact();CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//sort + unique in place, so the pattern is a set of sorted runs, one per block row
+	PetscErrorCode compact() noexcept
+	{
+		PetscFunctionBeginHot;
+		std::sort(m_pattern.begin(), m_pattern.end());
+		m_pattern.erase(std::unique(m_pattern.begin(), m_pattern.end()), m_pattern.end());
+		m_compacted = m_pattern.size();
+		PetscFunctionReturn(0);
+	}
+
+	//ships entries in rows we don't own to the rank that does (collective)
+	PetscErrorCode exchange() noexcept
+	{
+		PetscFunctionBegin;
+		MPI_Comm    comm;
+		PetscMPIInt size;
+		PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(m_mat), &comm);CHKERRQ(ierr);
+		ierr = MPI_Comm_size(comm, &size);CHKERRMPI(ierr);
+		if(size == 1)
+		{
+			PetscFunctionReturn(0);
+		}
+
+		ierr = compact();CHKERRQ(ierr);
+		const PetscInt rstart = m_rstart/m_bs, rend = m_rend/m_bs;
+		try
+		{
+			//bucket the remote entries by owner; m_pattern is sorted by row, so each owner's entries are a contiguous
+			//run and the send buffer is just the remote part of m_pattern in order
+			std::vector<PetscMPIInt> send_cnt(size, 0), recv_cnt(size), send_off(size), recv_off(size);
+			std::vector<entry> remote, local;
+			local.reserve(m_pattern.size());
+			for(const entry& e : m_pattern)
+			{
+				if(e.row >= rstart and e.row < rend)
+				{
+					local.push_back(e);
+					continue;
+				}
+				PetscMPIInt owner;
+				ierr = PetscLayoutFindOwner(m_mat->rmap, e.row*m_bs, &owner);CHKERRQ(ierr);
+				remote.push_back(e);
+				send_cnt[owner] += 2;
+			}
+			ierr = MPI_Alltoall(send_cnt.data(), 1, MPI_INT, recv_cnt.data(), 1, MPI_INT, comm);CHKERRMPI(ierr);
+			PetscMPIInt nrecv = 0;
+			for(PetscMPIInt p = 0, nsend = 0; p < size; ++p)
+			{
+				send_off[p] = nsend;
+				recv_off[p] = nrecv;
+				nsend += send_cnt[p];
+				nrecv += recv_cnt[p];
+			}
+			static_assert(sizeof(entry) == 2*sizeof(PetscInt), "entries are sent as pairs of PetscInts");
+			std::vector<entry> received(nrecv/2);
+			ierr = MPI_Alltoallv(remote.data(), send_cnt.data(), send_off.data(), MPIU_INT,
+					     received.data(), recv_cnt.data(), recv_off.data(), MPIU_INT, comm);CHKERRMPI(ierr);
+			local.insert(local.end(), received.begin(), received.end());
+			m_pattern.swap(local);
+		}
+		catch(const std::bad_alloc&)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	Mat      m_mat;//borrowed
+	PetscInt m_bs;
+	PetscInt m_rstart, m_rend;//local point rows
+	PetscInt m_cstart, m_cend;//columns of the diagonal block
+
+	std::vector<entry> m_pattern;
+	std::size_t        m_compacted;//size of m_pattern right after the last compaction
+};
+
+#endif //PETSC_MAT_PREALLOCATOR_HPP
@@ -0,0 +1,300 @@
+#ifndef PETSC_MIXED_PRECISION_HPP
+#define PETSC_MIXED_PRECISION_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include "petsc_pending_scatter.hpp"
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+#if defined(PETSC_USE_COMPLEX)
+#include <complex>
+#endif
+
+
+
+/* a reduced-precision copy of an AIJ matrix, for the places where an approximation of the operator is all that's
+ * needed (smoothers, inner solves of a preconditioner) while the outer Krylov method stays in full precision:
+ *
+ * petsc_smart_ptr<_p_Mat> A_low;
+ * ierr = petsc_mat_create_shadow(A, &A_low);CHKERRQ(ierr);
+ * ierr = KSPSetOperators(smoother, A_low, A);CHKERRQ(ierr);//Chebyshev/Richardson iterate with A_low, Jacobi uses A
+ *
+ * The shadow is a MATSHELL holding its own CSR copy of A's local rows (the diagonal and off-diagonal blocks for
+ * MATMPIAIJ) with S values and I indices, float and 32-bit by default: 8 bytes a nonzero instead of 12 or 16, and
+ * SpMV is bound by those bytes. Products are accumulated in PetscScalar, and x and y are ordinary Vecs.
+ *
+ * It stays in step with A by itself: every MatMult() compares A's state (PetscObjectStateGet()) with the one it was
+ * copied at, and copies the values again if A changed since, the pattern too if A's nonzero state changed. So
+ * changing A costs nothing until the shadow is used, and then a copy. MatGetDiagonal() on the shadow is A's (in
+ * full precision). The shadow holds a reference to A.
+ */
+
+#if defined(PETSC_USE_COMPLEX)
+using petsc_shadow_scalar = std::complex<float>;
+#else
+using petsc_shadow_scalar = float;
+#endif
+
+
+//the shadow's MatMult(), as the MATSHELL context: the copies of A's blocks and what's needed to multiply with them
+template<typename S = petsc_shadow_scalar, typename I = std::uint32_t>
+class petsc_shadow_operator
+{
+public:
+
+	explicit petsc_shadow_operator(Mat parent) noexcept :
+		m_parent(parent), m_state(0), m_nonzero_state(0), m_valid(false), m_scatter(NULL)
+	{};
+
+	petsc_shadow_operator(const petsc_shadow_operator&) = delete;
+	petsc_shadow_operator& operator=(const petsc_shadow_operator&) = delete;
+
+	petsc_shadow_operator(petsc_shadow_operator&& op) noexcept :
+		m_parent(std::move(op.m_parent)), m_state(op.m_state), m_nonzero_state(op.m_nonzero_state), m_valid(op.m_valid),
+		m_diag(std::move(op.m_diag)), m_offdiag(std::move(op.m_offdiag)), m_ghost(std::move(op.m_ghost)),
+		m_scatter(op.m_scatter)
+	{
+		op.m_scatter = NULL;
+		op.m_valid = false;
+	}
+
+	~petsc_shadow_operator() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecScatterDestroy(&m_scatter);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+	//y = shadow*x, bringing the copy up to date first if the parent changed
+	PetscErrorCode operator()(Vec x, Vec y) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = update();CHKERRQ(ierr);
+		//the ghost values travel while the diagonal block is done. Any return from here on ends the scatter
+		petsc_pending_scatter ghosts;
+		if(m_scatter)
+		{
+			ierr = petsc_pending_scatter::begin(m_scatter, x, m_ghost.get(), INSERT_VALUES, SCATTER_FORWARD, &ghosts);CHKERRQ(ierr);
+		}
+		petsc_vec_array<petsc_vec_write> y_arr(y);
+		{
+			petsc_vec_array<petsc_vec_read> x_arr(x);
+			if(not x_arr or not y_arr)
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "couldn't get the vector arrays");
+			}
+			m_diag.multiply(x_arr.data(), y_arr.data(), false);
+		}
+		if(m_scatter)
+		{
+			ierr = ghosts.wait();CHKERRQ(ierr);
+			petsc_vec_array<petsc_vec_read> ghost_arr(m_ghost.get());
+			if(not ghost_arr)
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "couldn't get the ghost values");
+			}
+			m_offdiag.multiply(ghost_arr.data(), y_arr.data(), true);
+		}
+		ierr = PetscLogFlops(2.0*(m_diag.nonzeros() + m_offdiag.nonzeros()));CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//copies the parent again if its state moved since the last copy; nothing otherwise
+	PetscErrorCode update() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscObjectState state;
+		PetscErrorCode ierr = PetscObjectStateGet((PetscObject)(m_parent.get()), &state);CHKERRQ(ierr);
+		if(m_valid and state == m_state)
+		{
+			PetscFunctionReturn(0);
+		}
+		PetscObjectState nonzero_state;
+		ierr = MatGetNonzeroState(m_parent.get(), &nonzero_state);CHKERRQ(ierr);
+		const bool pattern = not m_valid or nonzero_state != m_nonzero_state;
+		m_valid = false;
+
+		PetscBool mpi, seq;
+		ierr = PetscObjectBaseTypeCompare((PetscObject)(m_parent.get()), MATMPIAIJ, &mpi);CHKERRQ(ierr);
+		ierr = PetscObjectBaseTypeCompare((PetscObject)(m_parent.get()), MATSEQAIJ, &seq);CHKERRQ(ierr);
+		if(mpi)
+		{
+			Mat Ad, Ao;
+			const PetscInt* colmap;
+			ierr = MatMPIAIJGetSeqAIJ(m_parent.get(), &Ad, &Ao, &colmap);CHKERRQ(ierr);
+			ierr = m_diag.copy(Ad, pattern);CHKERRQ(ierr);
+			ierr = m_offdiag.copy(Ao, pattern);CHKERRQ(ierr);
+			if(pattern)
+			{
+				ierr = make_scatter(Ao, colmap);CHKERRQ(ierr);
+			}
+		}
+		else if(seq)
+		{
+			ierr = m_diag.copy(m_parent.get(), pattern);CHKERRQ(ierr);
+		}
+		else
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_SUP, "shadows are only made of MATSEQAIJ and MATMPIAIJ matrices");
+		}
+		m_state = state;
+		m_nonzero_state = nonzero_state;
+		m_valid = true;
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode get_diagonal(Mat A, Vec d)
+	{
+		PetscFunctionBegin;
+		petsc_shadow_operator* op;
+		PetscErrorCode ierr = MatShellGetContext(A, &op);CHKERRQ(ierr);
+		ierr = MatGetDiagonal(op->m_parent.get(), d);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	//one sequential AIJ block in CSR, at reduced precision
+	struct block
+	{
+		std::size_t nonzeros() const noexcept
+		{
+			return m_values.size();
+		}
+
+		//the values always, the pattern only if asked to
+		PetscErrorCode copy(Mat B, bool pattern) noexcept
+		{
+			PetscFunctionBegin;
+			PetscErrorCode ierr;
+			if(pattern)
+			{
+				ierr = copy_pattern(B);CHKERRQ(ierr);
+			}
+			const PetscScalar* a;
+			ierr = MatSeqAIJGetArrayRead(B, &a);CHKERRQ(ierr);
+			for(std::size_t k = 0; k < m_values.size(); ++k)
+			{
+				m_values[k] = static_cast<S>(a[k]);
+			}
+			ierr = MatSeqAIJRestoreArrayRead(B, &a);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+
+		//y = B*x, or y += B*x
+		void multiply(const PetscScalar* x, PetscScalar* y, bool add) const noexcept
+		{
+			const std::size_t m = m_rows.empty() ? 0 : m_rows.size() - 1;
+			for(std::size_t row = 0; row < m; ++row)
+			{
+				PetscScalar sum = add ? y[row] : PetscScalar(0);
+				for(I k = m_rows[row]; k < m_rows[row + 1]; ++k)
+				{
+					sum += static_cast<PetscScalar>(m_values[k])*x[m_cols[k]];
+				}
+				y[row] = sum;
+			}
+		}
+
+		PetscErrorCode copy_pattern(Mat B) noexcept
+		{
+			PetscFunctionBegin;
+			PetscInt m, n;
+			const PetscInt* ia;
+			const PetscInt* ja;
+			PetscBool done;
+			PetscErrorCode ierr = MatGetSize(B, NULL, &n);CHKERRQ(ierr);
+			ierr = MatGetRowIJ(B, 0, PETSC_FALSE, PETSC_FALSE, &m, &ia, &ja, &done);CHKERRQ(ierr);
+			if(not done)
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_SUP, "couldn't get the matrix's CSR pattern");
+			}
+			const PetscInt nnz = ia[m];
+			if(static_cast<std::uintmax_t>(nnz) > std::numeric_limits<I>::max() or
+			   static_cast<std::uintmax_t>(n) > std::numeric_limits<I>::max())
+			{
+				ierr = MatRestoreRowIJ(B, 0, PETSC_FALSE, PETSC_FALSE, &m, &ia, &ja, &done);CHKERRQ(ierr);
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_OUTOFRANGE, "matrix block too big for the shadow's index type");
+			}
+			bool allocated = true;
+			try
+			{
+				m_rows.assign(ia, ia + m + 1);
+				m_cols.assign(ja, ja + nnz);
+				m_values.resize(static_cast<std::size_t>(nnz));
+			}
+			catch(const std::bad_alloc&)
+			{
+				allocated = false;
+			}
+			ierr = MatRestoreRowIJ(B, 0, PETSC_FALSE, PETSC_FALSE, &m, &ia, &ja, &done);CHKERRQ(ierr);
+			if(not allocated)
+			{
+				PetscFunctionReturn(PETSC_ERR_MEM);
+			}
+			PetscFunctionReturn(0);
+		}
+
+		std::vector<I> m_rows;
+		std::vector<I> m_cols;
+		std::vector<S> m_values;
+	};
+
+	//moves the ghost values the off-diagonal block's (compacted) columns stand for into m_ghost
+	PetscErrorCode make_scatter(Mat Ao, const PetscInt* colmap) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecScatterDestroy(&m_scatter);CHKERRQ(ierr);
+		PetscInt nghost;
+		ierr = MatGetSize(Ao, NULL, &nghost);CHKERRQ(ierr);
+		Vec ghost;
+		ierr = VecCreateSeq(PETSC_COMM_SELF, nghost, &ghost);CHKERRQ(ierr);
+		ierr = m_ghost.reset(ghost, petsc_adopt);CHKERRQ(ierr);
+		IS from;
+		ierr = ISCreateGeneral(PETSC_COMM_SELF, nghost, colmap, PETSC_COPY_VALUES, &from);CHKERRQ(ierr);
+		Vec x;
+		ierr = MatCreateVecs(m_parent.get(), &x, NULL);CHKERRQ(ierr);
+		ierr = VecScatterCreate(x, from, ghost, NULL, &m_scatter);CHKERRQ(ierr);
+		ierr = VecDestroy(&x);CHKERRQ(ierr);
+		ierr = ISDestroy(&from);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	petsc_smart_ptr<_p_Mat> m_parent;
+	PetscObjectState        m_state;
+	PetscObjectState        m_nonzero_state;
+	bool                    m_valid;
+	block                   m_diag;
+	block                   m_offdiag;
+	petsc_smart_ptr<_p_Vec> m_ghost;
+	VecScatter              m_scatter;
+};
+
+
+//*shadow is a reduced-precision shadow of parent (see above), copied right away so that errors (the wrong matrix
+//type, indices that don't fit I) show up here rather than in the first MatMult()
+template<typename S = petsc_shadow_scalar, typename I = std::uint32_t, typename DestroyPolicy>
+PetscErrorCode petsc_mat_create_shadow(const petsc_smart_ptr<_p_Mat, DestroyPolicy>& parent,
+				       petsc_smart_ptr<_p_Mat, DestroyPolicy>* shadow) noexcept
+{
+	PetscFunctionBegin;
+	using operator_type = petsc_shadow_operator<S, I>;
+	operator_type op(parent.get());
+	PetscErrorCode ierr = op.update();CHKERRQ(ierr);
+	MPI_Comm comm;
+	ierr = PetscObjectGetComm((PetscObject)(parent.get()), &comm);CHKERRQ(ierr);
+	petsc_mat_sizes sizes;
+	ierr = MatGetLocalSize(parent.get(), &sizes.m, &sizes.n);CHKERRQ(ierr);
+	ierr = MatGetSize(parent.get(), &sizes.M, &sizes.N);CHKERRQ(ierr);
+	petsc_smart_ptr<_p_Mat, DestroyPolicy> A = petsc_smart_ptr<_p_Mat, DestroyPolicy>::make_shell(comm, sizes, std::move(op));
+	if(not A)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "couldn't create the shadow matrix");
+	}
+	ierr = MatShellSetOperation(A.get(), MATOP_GET_DIAGONAL, (void (*)(void))(&operator_type::get_diagonal));CHKERRQ(ierr);
+	shadow->swap(A);
+	PetscFunctionReturn(0);
+}
+
+#endif //PETSC_MIXED_PRECISION_HPP
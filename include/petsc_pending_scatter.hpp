@@ -0,0 +1,225 @@
+#ifndef PETSC_PENDING_SCATTER_HPP
+#define PETSC_PENDING_SCATTER_HPP
+
+#include "petsc_smart_ptr.hpp"
+
+
+
+/* a VecScatter or ghost update that has been begun and not yet ended. Begin is issued when the object is made,
+ * End when wait() is called or when it goes out of scope, so the communication can't be left dangling (e.g. by an
+ * early return on error) and overlapping it with computation is just:
+ *
+ * {
+ * 	petsc_pending_scatter ghosts = petsc_ghost_update_begin(u, INSERT_VALUES, SCATTER_FORWARD);
+ * 	//interior work that doesn't touch the ghost values
+ * 	ierr = ghosts.wait();CHKERRQ(ierr);
+ * 	//boundary work
+ * }
+ *
+ * It's move-only (like the Begin/End pair it stands for, it can only be ended once), so several can be in flight
+ * at once, e.g. kept in a std::vector and ended together with petsc_wait_all(). Same rules as PETSc's: the Vecs
+ * involved mustn't be touched until it's ended, and every rank has to end it.
+ *
+ * The scatter and Vecs are borrowed (no reference is taken), so they have to outlive it. wait() reports errors;
+ * the destructor can only print them.
+ */
+class petsc_pending_scatter
+{
+public:
+
+	//nothing in flight
+	constexpr petsc_pending_scatter() noexcept :
+		m_sct(NULL), m_x(NULL), m_y(NULL), m_imode(INSERT_VALUES), m_smode(SCATTER_FORWARD)
+	{};
+
+	//VecScatterBegin(sct, x, y, imode, smode)
+	petsc_pending_scatter(VecScatter sct, Vec x, Vec y, InsertMode imode, ScatterMode smode) noexcept :
+		m_sct(NULL), m_x(NULL), m_y(NULL), m_imode(imode), m_smode(smode)
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = begin(sct, x, y, imode, smode, this);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	//VecGhostUpdateBegin(ghosted, imode, smode)
+	petsc_pending_scatter(Vec ghosted, InsertMode imode, ScatterMode smode) noexcept :
+		m_sct(NULL), m_x(NULL), m_y(NULL), m_imode(imode), m_smode(smode)
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = ghost_update_begin(ghosted, imode, smode, this);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	petsc_pending_scatter(const petsc_pending_scatter&) = delete;
+	petsc_pending_scatter& operator=(const petsc_pending_scatter&) = delete;
+
+	petsc_pending_scatter(petsc_pending_scatter&& pending) noexcept :
+		m_sct(pending.m_sct), m_x(pending.m_x), m_y(pending.m_y), m_imode(pending.m_imode), m_smode(pending.m_smode)
+	{
+		pending.clear();
+	}
+
+	//ends whatever this one had in flight first
+	petsc_pending_scatter& operator=(petsc_pending_scatter&& pending) noexcept
+	{
+		if(this != &pending)
+		{
+			PetscErrorCode ierr = wait();CHKERRABORT(PETSC_COMM_SELF, ierr);
+			m_sct = pending.m_sct;
+			m_x = pending.m_x;
+			m_y = pending.m_y;
+			m_imode = pending.m_imode;
+			m_smode = pending.m_smode;
+			pending.clear();
+		}
+		return *this;
+	}
+
+	~petsc_pending_scatter() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = wait();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//same as the constructors, but reporting errors: ends whatever *pending had in flight, then begins the new one.
+	//*pending is only pending if Begin went through, so a failed one isn't ended
+	static PetscErrorCode begin(VecScatter sct, Vec x, Vec y, InsertMode imode, ScatterMode smode,
+				    petsc_pending_scatter* pending) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = pending->wait();CHKERRQ(ierr);
+		ierr = VecScatterBegin(sct, x, y, imode, smode);CHKERRQ(ierr);
+		pending->m_sct = sct;
+		pending->m_x = x;
+		pending->m_y = y;
+		pending->m_imode = imode;
+		pending->m_smode = smode;
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode ghost_update_begin(Vec ghosted, InsertMode imode, ScatterMode smode,
+						 petsc_pending_scatter* pending) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = pending->wait();CHKERRQ(ierr);
+		ierr = VecGhostUpdateBegin(ghosted, imode, smode);CHKERRQ(ierr);
+		pending->m_x = ghosted;
+		pending->m_imode = imode;
+		pending->m_smode = smode;
+		PetscFunctionReturn(0);
+	}
+
+
+	//ends it (VecScatterEnd or VecGhostUpdateEnd); does nothing if it isn't pending
+	PetscErrorCode wait() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(not pending())
+		{
+			PetscFunctionReturn(0);
+		}
+		VecScatter sct = m_sct;
+		Vec        x = m_x;
+		Vec        y = m_y;
+		//not pending anymore even if End fails, since it can't be retried
+		clear();
+		PetscErrorCode ierr;
+		if(sct)
+		{
+			ierr = VecScatterEnd(sct, x, y, m_imode, m_smode);CHKERRQ(ierr);
+		}
+		else
+		{
+			ierr = VecGhostUpdateEnd(x, m_imode, m_smode);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	bool pending() const noexcept
+	{
+		return m_x != NULL;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return pending();
+	}
+
+private:
+
+	void clear() noexcept
+	{
+		m_sct = NULL;
+		m_x = NULL;
+		m_y = NULL;
+	}
+
+	VecScatter  m_sct;//NULL for a ghost update
+	Vec         m_x;  //NULL when nothing is pending
+	Vec         m_y;
+	InsertMode  m_imode;
+	ScatterMode m_smode;
+};
+
+
+inline petsc_pending_scatter petsc_scatter_begin(VecScatter sct, Vec x, Vec y, InsertMode imode, ScatterMode smode) noexcept
+{
+	return petsc_pending_scatter(sct, x, y, imode, smode);
+}
+
+template<typename DestroyPolicy>
+petsc_pending_scatter petsc_scatter_begin(VecScatter sct, const petsc_smart_ptr<_p_Vec, DestroyPolicy>& x,
+					  const petsc_smart_ptr<_p_Vec, DestroyPolicy>& y, InsertMode imode, ScatterMode smode) noexcept
+{
+	return petsc_pending_scatter(sct, x.get(), y.get(), imode, smode);
+}
+
+inline petsc_pending_scatter petsc_ghost_update_begin(Vec ghosted, InsertMode imode, ScatterMode smode) noexcept
+{
+	return petsc_pending_scatter(ghosted, imode, smode);
+}
+
+template<typename DestroyPolicy>
+petsc_pending_scatter petsc_ghost_update_begin(const petsc_smart_ptr<_p_Vec, DestroyPolicy>& ghosted, InsertMode imode,
+					       ScatterMode smode) noexcept
+{
+	return petsc_pending_scatter(ghosted.get(), imode, smode);
+}
+
+
+//ends all of them, in order. Every one gets ended even if an earlier End fails; the first error is returned
+inline PetscErrorCode petsc_wait_all(petsc_array_view<petsc_pending_scatter> pending) noexcept
+{
+	PetscFunctionBegin;
+	PetscErrorCode first_ierr = 0;
+	for(petsc_pending_scatter& p : pending)
+	{
+		PetscErrorCode ierr = p.wait();
+		if(ierr and not first_ierr)
+		{
+			first_ierr = ierr;
+		}
+	}
+	CHKERRQ(first_ierr);
+	PetscFunctionReturn(0);
+}
+
+inline PetscErrorCode petsc_wait_all() noexcept
+{
+	return 0;
+}
+
+template<typename... Pending>
+PetscErrorCode petsc_wait_all(petsc_pending_scatter& first, Pending&... rest) noexcept
+{
+	PetscFunctionBegin;
+	PetscErrorCode ierr = first.wait();
+	PetscErrorCode rest_ierr = petsc_wait_all(rest...);
+	CHKERRQ(ierr);
+	CHKERRQ(rest_ierr);
+	PetscFunctionReturn(0);
+}
+
+#endif //PETSC_PENDING_SCATTER_HPP
@@ -0,0 +1,226 @@
+#ifndef PETSC_REPARTITION_HPP
+#define PETSC_REPARTITION_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include "petsc_deferred_destroy.hpp"
+#include <new>
+#include <vector>
+
+
+
+/* rebalancing a distributed square matrix, and the vectors laid out like its rows, when the rows no longer split
+ * evenly over the ranks (e.g. after adaptive refinement):
+ *
+ * petsc_smart_ptr<_p_Mat> A;
+ * petsc_smart_ptr<_p_Vec> vecs[2];//x and b, both with A's row layout
+ * ...
+ * ierr = petsc_repartition(&A, petsc_array_view<petsc_smart_ptr<_p_Vec>>(vecs, 2));CHKERRQ(ierr);
+ *
+ * A MatPartitioning on A's graph (ParMETIS, PT-Scotch, ...: whatever -mat_partitioning_type or type says, rows weighed
+ * by their nonzeros) decides where each row goes; MatCreateSubMatrix() moves the matrix and one VecScatter moves
+ * all the vectors. Afterwards the handles hold the rebalanced objects, renumbered so that each rank's rows are
+ * contiguous again (in their old order). The old objects go onto petsc_destroy_queue rather than being destroyed
+ * right there, so their teardown (a collective exchange per object) happens at the next drain; anybody else still
+ * holding one keeps the old, unbalanced object. Collective on A's communicator.
+ *
+ * The new vectors have the old ones' types. Their block size is kept if the new split leaves every rank a whole
+ * number of blocks (the partitioner works on rows, so it needn't), and is 1 otherwise. Ghosting isn't kept: the
+ * ghost indices of the old layout mean nothing in the new one, so ghosted vectors come back plain.
+ *
+ * On failure the handles are left alone: everything is built before any of them changes hands.
+ */
+
+
+//owns a PETSc object there's no handle for (an IS, a VecScatter, ...) until the end of a scope
+template<typename T, PetscErrorCode (*Destroy)(T*)>
+class petsc_scoped_object
+{
+public:
+
+	petsc_scoped_object() noexcept : m_obj(NULL)
+	{};
+
+	petsc_scoped_object(const petsc_scoped_object&) = delete;
+	petsc_scoped_object& operator=(const petsc_scoped_object&) = delete;
+
+	~petsc_scoped_object() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = Destroy(&m_obj);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+	//for XxxCreate(..., &obj.out())
+	T& out() noexcept
+	{
+		return m_obj;
+	}
+
+	T get() const noexcept
+	{
+		return m_obj;
+	}
+
+	//hands the object to the caller, who destroys it
+	T release() noexcept
+	{
+		T obj = m_obj;
+		m_obj = NULL;
+		return obj;
+	}
+
+private:
+
+	T m_obj;
+};
+
+
+//IS of the (old, global) rows that should end up on this rank, sorted; the caller destroys it. A NULL type leaves
+//it to the options database (-mat_partitioning_type), and to PETSc's default if that's not set either
+inline PetscErrorCode petsc_repartition_rows(Mat A, MatPartitioningType type, PetscBool weight_by_nonzeros, IS* rows) noexcept
+{
+	PetscFunctionBegin;
+	MPI_Comm comm;
+	PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(A), &comm);CHKERRQ(ierr);
+	petsc_scoped_object<MatPartitioning, MatPartitioningDestroy> part;
+	ierr = MatPartitioningCreate(comm, &part.out());CHKERRQ(ierr);
+	//MatPartitioningApply() converts A to the adjacency format it needs
+	ierr = MatPartitioningSetAdjacency(part.get(), A);CHKERRQ(ierr);
+	if(type)
+	{
+		ierr = MatPartitioningSetType(part.get(), type);CHKERRQ(ierr);
+	}
+	ierr = MatPartitioningSetFromOptions(part.get());CHKERRQ(ierr);
+	if(weight_by_nonzeros)
+	{
+		//balance work (nonzeros) rather than rows
+		PetscInt rstart, rend;
+		ierr = MatGetOwnershipRange(A, &rstart, &rend);CHKERRQ(ierr);
+		PetscInt* weights;
+		ierr = PetscMalloc1(rend - rstart, &weights);CHKERRQ(ierr);
+		for(PetscInt row = rstart; row < rend and not ierr; ++row)
+		{
+			PetscInt ncols;
+			ierr = MatGetRow(A, row, &ncols, NULL, NULL);
+			if(not ierr)
+			{
+				//ParMETIS rejects zero weights
+				weights[row - rstart] = ncols > 0 ? ncols : 1;
+				ierr = MatRestoreRow(A, row, &ncols, NULL, NULL);
+			}
+		}
+		if(ierr)
+		{
+			(void)PetscFree(weights);
+			CHKERRQ(ierr);
+		}
+		//the partitioning takes over weights (and PetscFree()s it)
+		ierr = MatPartitioningSetVertexWeights(part.get(), weights);CHKERRQ(ierr);
+	}
+	petsc_scoped_object<IS, ISDestroy> destination;
+	ierr = MatPartitioningApply(part.get(), &destination.out());CHKERRQ(ierr);
+	//destination says where each of our rows goes; turn it around into which rows come here. Unlike
+	//ISInvertPermutation(), this doesn't gather anything of global size
+	petsc_scoped_object<IS, ISDestroy> incoming;
+	ierr = ISBuildTwoSided(destination.get(), NULL, &incoming.out());CHKERRQ(ierr);
+	ierr = ISSort(incoming.get());CHKERRQ(ierr);
+	*rows = incoming.release();
+	PetscFunctionReturn(0);
+}
+
+
+//rebalances *A and every handle in vecs in place (see above). rows (optional) gets the IS petsc_repartition_rows()
+//made, to move other data the same way; the caller destroys it
+template<typename MatDestroyPolicy, typename VecDestroyPolicy>
+PetscErrorCode petsc_repartition(petsc_smart_ptr<_p_Mat, MatDestroyPolicy>* A,
+				 petsc_array_view<petsc_smart_ptr<_p_Vec, VecDestroyPolicy>> vecs,
+				 MatPartitioningType type=NULL, IS* rows=NULL, PetscBool weight_by_nonzeros=PETSC_TRUE) noexcept
+{
+	PetscFunctionBegin;
+	PetscInt M, N, m, n;
+	PetscErrorCode ierr = MatGetSize(A->get(), &M, &N);CHKERRQ(ierr);
+	ierr = MatGetLocalSize(A->get(), &m, &n);CHKERRQ(ierr);
+	if(M != N)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_WRONG, "repartitioning needs a square matrix");
+	}
+	for(const petsc_smart_ptr<_p_Vec, VecDestroyPolicy>& v : vecs)
+	{
+		PetscInt vn;
+		ierr = VecGetLocalSize(v.get(), &vn);CHKERRQ(ierr);
+		if(vn != m)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "vector layout doesn't match the matrix rows");
+		}
+	}
+
+	petsc_scoped_object<IS, ISDestroy> keep;
+	ierr = petsc_repartition_rows(A->get(), type, weight_by_nonzeros, &keep.out());CHKERRQ(ierr);
+	//the same IS for rows and columns, so the new matrix is a symmetric permutation of the old one
+	Mat B;
+	ierr = MatCreateSubMatrix(A->get(), keep.get(), keep.get(), MAT_INITIAL_MATRIX, &B);CHKERRQ(ierr);
+	petsc_smart_ptr<_p_Mat, MatDestroyPolicy> moved(B, petsc_adopt);
+
+	std::vector<petsc_smart_ptr<_p_Vec, VecDestroyPolicy>> moved_vecs;
+	try
+	{
+		moved_vecs.resize(vecs.size());
+	}
+	catch(const std::bad_alloc&)
+	{
+		PetscFunctionReturn(PETSC_ERR_MEM);
+	}
+	if(not vecs.empty())
+	{
+		PetscInt local;
+		ierr = ISGetLocalSize(keep.get(), &local);CHKERRQ(ierr);
+		MPI_Comm comm;
+		ierr = PetscObjectGetComm((PetscObject)(vecs[0].get()), &comm);CHKERRQ(ierr);
+		for(std::size_t k = 0; k < vecs.size(); ++k)
+		{
+			VecType vtype;
+			PetscInt bs;
+			ierr = VecGetType(vecs[k].get(), &vtype);CHKERRQ(ierr);
+			ierr = VecGetBlockSize(vecs[k].get(), &bs);CHKERRQ(ierr);
+			//collective, so every rank agrees on whether the block size survives
+			PetscMPIInt whole = local % bs == 0, all_whole;
+			ierr = MPI_Allreduce(&whole, &all_whole, 1, MPI_INT, MPI_MIN, comm);CHKERRMPI(ierr);
+			Vec x;
+			ierr = VecCreate(comm, &x);CHKERRQ(ierr);
+			ierr = moved_vecs[k].reset(x, petsc_adopt);CHKERRQ(ierr);
+			ierr = VecSetSizes(x, local, N);CHKERRQ(ierr);
+			if(bs > 1 and all_whole)
+			{
+				ierr = VecSetBlockSize(x, bs);CHKERRQ(ierr);
+			}
+			ierr = VecSetType(x, vtype);CHKERRQ(ierr);
+		}
+		//new entry k on this rank is old entry keep[k]: one scatter, built once, moves every vector
+		petsc_scoped_object<VecScatter, VecScatterDestroy> scatter;
+		ierr = VecScatterCreate(vecs[0].get(), keep.get(), moved_vecs[0].get(), NULL, &scatter.out());CHKERRQ(ierr);
+		for(std::size_t k = 0; k < vecs.size(); ++k)
+		{
+			ierr = VecScatterBegin(scatter.get(), vecs[k].get(), moved_vecs[k].get(), INSERT_VALUES, SCATTER_FORWARD);CHKERRQ(ierr);
+			ierr = VecScatterEnd(scatter.get(), vecs[k].get(), moved_vecs[k].get(), INSERT_VALUES, SCATTER_FORWARD);CHKERRQ(ierr);
+		}
+	}
+
+	//everything's built: swap the new objects in (which can't fail), then queue the old ones, now in moved*
+	A->swap(moved);
+	for(std::size_t k = 0; k < vecs.size(); ++k)
+	{
+		vecs[k].swap(moved_vecs[k]);
+	}
+	if(rows)
+	{
+		*rows = keep.release();
+	}
+	ierr = petsc_destroy_queue::push((PetscObject)(moved.release()));CHKERRQ(ierr);
+	for(petsc_smart_ptr<_p_Vec, VecDestroyPolicy>& v : moved_vecs)
+	{
+		ierr = petsc_destroy_queue::push((PetscObject)(v.release()));CHKERRQ(ierr);
+	}
+	PetscFunctionReturn(0);
+}
+
+#endif //PETSC_REPARTITION_HPP
@@ -0,0 +1,146 @@
+#ifndef PETSC_SHARED_PTR_HPP
+#define PETSC_SHARED_PTR_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <atomic>
+#include <new>
+
+
+
+/* thread-shareable handle. PETSc's refcount is a plain int, so copying a petsc_smart_ptr from several threads at
+ * once races. A petsc_shared_ptr group instead holds exactly one PETSc reference between all of its copies, and
+ * counts the copies with its own atomic counter: copying is one relaxed atomic increment (no lock, no PETSc call),
+ * and the PETSc reference is dropped when the last copy goes away.
+ *
+ * Only the count is thread safe. Whichever thread lets go last runs the typed destroy, so that has to be a thread
+ * that's allowed to call PETSc at that point (as does anything else done with the object itself).
+ */
+template<typename T, typename DestroyPolicy = petsc_default_destroy>
+class petsc_shared_ptr
+{
+public:
+
+	using type = T;
+	using handle_type = petsc_smart_ptr<T, DestroyPolicy>;
+
+	constexpr petsc_shared_ptr() noexcept : m_block(NULL)
+	{};
+
+	//the group takes its own PETSc reference to ptr's object
+	explicit petsc_shared_ptr(const handle_type& ptr) noexcept : petsc_shared_ptr(handle_type(ptr))
+	{};
+
+	//the group takes over ptr's reference; ptr is null afterwards
+	explicit petsc_shared_ptr(handle_type&& ptr) noexcept : m_block(NULL)
+	{
+		PetscFunctionBegin;
+		if(ptr)
+		{
+			m_block = new (std::nothrow) control_block(std::move(ptr));
+			if(not m_block)
+			{
+				//ptr still holds the reference, so its dtor drops it
+				PetscErrorCode ierr = PETSC_ERR_MEM;CHKERRV(ierr);
+			}
+		}
+		PetscFunctionReturnVoid();
+	};
+
+	petsc_shared_ptr(const petsc_shared_ptr& ptr) noexcept : m_block(ptr.m_block)
+	{
+		if(m_block)
+		{
+			//relaxed is enough: whoever we're copying from already holds a count, so it can't hit zero meanwhile
+			m_block->count.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	petsc_shared_ptr(petsc_shared_ptr&& ptr) noexcept : m_block(ptr.m_block)
+	{
+		ptr.m_block = NULL;
+	}
+
+	petsc_shared_ptr& operator=(petsc_shared_ptr ptr) noexcept
+	{
+		swap(ptr);
+		return *this;
+	}
+
+	~petsc_shared_ptr() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = reset();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+
+	//drops this copy; the last copy of the group drops the PETSc reference
+	PetscErrorCode reset() noexcept
+	{
+		PetscFunctionBeginHot;
+		control_block* block = m_block;
+		m_block = NULL;
+		//acq_rel so that everything the other copies did happens before the destroy
+		if(block and block->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			PetscErrorCode ierr = block->ptr.reset();
+			delete block;
+			CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	void swap(petsc_shared_ptr& ptr) noexcept
+	{
+		std::swap(m_block, ptr.m_block);
+	}
+
+
+	T* get() const noexcept
+	{
+		return m_block ? m_block->ptr.get() : NULL;
+	}
+
+	T* operator->() const noexcept
+	{
+		return get();
+	}
+
+	T& operator*() const noexcept
+	{
+		return *get();
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_block != NULL;
+	}
+
+	//number of copies in the group (not the PETSc refcount). Only a snapshot if other threads are copying
+	long use_count() const noexcept
+	{
+		return m_block ? m_block->count.load(std::memory_order_relaxed) : 0;
+	}
+
+	//the group's petsc_smart_ptr. Copying it takes a PETSc reference, so only do that on one thread at a time
+	const handle_type& handle() const noexcept
+	{
+		static const handle_type null_handle;
+		return m_block ? m_block->ptr : null_handle;
+	}
+
+private:
+
+	struct control_block
+	{
+		explicit control_block(handle_type&& p) noexcept : count(1), ptr(std::move(p))
+		{};
+
+		std::atomic<long> count;
+		handle_type       ptr;//the group's one PETSc reference
+	};
+
+	control_block* m_block;
+};
+
+#endif //PETSC_SHARED_PTR_HPP
@@ -6,339 +6,1829 @@ extern "C" {
 #include <mpi.h>
 #include <petscerror.h>
 #include <petscsys.h>
+#include <petscvec.h>
 #include <petscmat.h>
-#include <petsc/src/sys/objects/inherit.h>
+#include <petsc/private/petscimpl.h>//struct _p_PetscObject
+#include <petsc/private/vecimpl.h>//struct _p_Vec
 #include <petsc/private/matimpl.h>//struct _p_Mat
-#include <stdlib.h>
 }
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
 #include <type_traits>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#if defined(PETSC_SMART_PTR_TRACK)
+#include <atomic>
+#include <cstdint>
+#if defined(__GLIBC__) || defined(__APPLE__)
+#define PETSC_SMART_PTR_HAVE_BACKTRACE
+#include <execinfo.h>
+#endif
+#endif
 
 
 
-//TODO: decide if communicator is an integral part of the class (e.g. a member variable) or is a visitor
+/* communicators. A handle doesn't store one: that would double its size (handles are one pointer, see the
+ * static_asserts at the bottom), and every PETSc object carries one already, the inner communicator PETSc
+ * duplicated from the one it was created on, which the handles' comm() returns. What is worth keeping around is
+ * that duplicate. PETSc caches it on the user communicator and shares it between all objects on it, but frees it
+ * once the last of them is destroyed, so code that keeps creating and destroying objects on a communicator with no
+ * long-lived object on it pays for an MPI_Comm_dup() every time. A petsc_comm holds a reference to the inner
+ * communicator, so every object created on it (or on the user communicator it came from) while it lives just
+ * bumps a reference count:
+ *
+ * petsc_comm comm(PETSC_COMM_WORLD);
+ * for(step)
+ * {
+ * 	petsc_handle<Vec> work(comm);//no MPI_Comm_dup()
+ * 	...
+ * }
+ *
+ * Copies share the same inner communicator. Like the handles, it has to go before PetscFinalize().
+ */
+class petsc_comm
+{
+public:
+
+	//references (duplicating, the first time) the inner communicator of comm
+	explicit petsc_comm(MPI_Comm comm) noexcept : m_comm(MPI_COMM_NULL)
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = PetscCommDuplicate(comm, &m_comm, NULL);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	petsc_comm(const petsc_comm& comm) noexcept : petsc_comm(comm.m_comm)
+	{};
+
+	petsc_comm(petsc_comm&& comm) noexcept : m_comm(comm.m_comm)
+	{
+		comm.m_comm = MPI_COMM_NULL;
+	}
+
+	petsc_comm& operator=(petsc_comm comm) noexcept
+	{
+		std::swap(m_comm, comm.m_comm);
+		return *this;
+	}
+
+	~petsc_comm() noexcept
+	{
+		PetscFunctionBegin;
+		if(m_comm != MPI_COMM_NULL)
+		{
+			PetscErrorCode ierr = PetscCommDestroy(&m_comm);CHKERRV(ierr);
+		}
+		PetscFunctionReturnVoid();
+	}
+
+	//the inner communicator (MPI_COMM_NULL if duplicating failed). Objects can be created on it directly
+	MPI_Comm get() const noexcept
+	{
+		return m_comm;
+	}
+
+	operator MPI_Comm() const noexcept
+	{
+		return m_comm;
+	}
+
+private:
+
+	MPI_Comm m_comm;
+};
+
+
+/* destroy policies -- these decide what (if anything) gets checked right before a handle lets go of its object,
+ * and how it lets go. A policy is just a struct with a
+ *
+ * template<typename T> static PetscErrorCode check(T* ptr) noexcept;
+ *
+ * that returns nonzero if the object must not be released, and a
+ *
+ * template<typename T, typename Destroy> static PetscErrorCode release(T** ptr, Destroy destroy) noexcept;
+ *
+ * that drops the handle's reference, normally by calling destroy(ptr) (the typed destroy, e.g. MatDestroy()).
+ * *ptr doesn't have to be nulled, the handle does that.
+ */
+
+//the usual release: typed destroy right away
+struct petsc_immediate_release
+{
+	template<typename T, typename Destroy>
+	static PetscErrorCode release(T** ptr, Destroy destroy) noexcept
+	{
+		return destroy(ptr);
+	}
+};
+
+//checked destruction: makes sure nobody is trying to tell us something (pending incoming messages on the
+//object's communicator, e.g. an unfinished scatter) and that we actually still hold a reference before dropping
+//it. Costs an MPI progress-engine call per destruction.
+struct petsc_checked_destroy : petsc_immediate_release
+{
+	template<typename T>
+	static PetscErrorCode check(T* ptr) noexcept
+	{
+		PetscFunctionBegin;
+		//anybody else have a problem and trying to tell us? if so, we can't delete
+		PetscMPIInt flag;
+		MPI_Status  stat;//in case flag is true
+		MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, PetscObjectComm((PetscObject)(ptr)), &flag, &stat);
+		if(flag)
+		{
+			//TODO: implement this (the case where there is some incoming message)
+			PetscFunctionReturn(PETSC_ERR_SIG);
+		}
+
+		//releasing an object nobody holds a reference to is a double free waiting to happen
+		PetscInt refcnt;
+		PetscErrorCode ierr = PetscObjectGetReference((PetscObject)(ptr), &refcnt);
+		if(ierr)
+		{
+			PetscFunctionReturn(ierr);
+		}
+		if(refcnt < 1)
+		{
+			PetscFunctionReturn(PETSC_ERR_WRONGSTATE);
+		}
+
+		PetscFunctionReturn(0);
+	}
+};
+
+//fast destruction: no checks, the handle just does the dereference or typed destroy
+struct petsc_fast_destroy : petsc_immediate_release
+{
+	template<typename T>
+	static PetscErrorCode check(T*) noexcept
+	{
+		return 0;
+	}
+};
+
+//checked in debug builds, fast in release builds. Define PETSC_SMART_PTR_CHECKED_DESTROY or
+//PETSC_SMART_PTR_FAST_DESTROY to override.
+#if defined(PETSC_SMART_PTR_CHECKED_DESTROY) || (defined(PETSC_USE_DEBUG) && !defined(PETSC_SMART_PTR_FAST_DESTROY))
+using petsc_default_destroy = petsc_checked_destroy;
+#else
+using petsc_default_destroy = petsc_fast_destroy;
+#endif
+
+
+//tag for constructors that take over a reference the caller already owns (e.g. an object fresh out of
+//XxxCreate()) instead of taking a new one
+struct petsc_adopt_t
+{
+	explicit constexpr petsc_adopt_t() noexcept {}
+};
+constexpr petsc_adopt_t petsc_adopt{};
+
+
+//local/global sizes of a matrix, same meaning (and defaults) as MatSetSizes()'s arguments
+struct petsc_mat_sizes
+{
+	constexpr petsc_mat_sizes(PetscInt m_=PETSC_DECIDE, PetscInt n_=PETSC_DECIDE,
+				  PetscInt M_=PETSC_DETERMINE, PetscInt N_=PETSC_DETERMINE) noexcept :
+		m(m_), n(n_), M(M_), N(N_)
+	{};
+
+	PetscInt m, n;//local rows, columns
+	PetscInt M, N;//global rows, columns
+};
+
+
+//contiguous, non-owning view of a borrowed array -- basically a C++11 std::span. Converts to std::span when
+//that's available
+template<typename S>
+class petsc_array_view
+{
+public:
+
+	using element_type = S;
+	using value_type = typename std::remove_cv<S>::type;
+	using size_type = std::size_t;
+	using pointer = S*;
+	using reference = S&;
+	using iterator = S*;
+
+	constexpr petsc_array_view() noexcept : m_data(NULL), m_size(0)
+	{};
+
+	constexpr petsc_array_view(S* data, size_type size) noexcept : m_data(data), m_size(size)
+	{};
+
+	//anything contiguous with data() and size(), e.g. std::vector or std::span
+	template<typename C, typename = typename std::enable_if<
+		not std::is_base_of<petsc_array_view, typename std::decay<C>::type>::value and
+		std::is_convertible<decltype(std::declval<C&>().data()), S*>::value>::type>
+	petsc_array_view(C&& c) noexcept : m_data(c.data()), m_size(static_cast<size_type>(c.size()))
+	{};
+
+	constexpr S* data() const noexcept
+	{
+		return m_data;
+	}
+
+	constexpr size_type size() const noexcept
+	{
+		return m_size;
+	}
+
+	constexpr bool empty() const noexcept
+	{
+		return m_size == 0;
+	}
+
+	//no bounds checking, same as std::span
+	constexpr S& operator[](size_type i) const noexcept
+	{
+		return m_data[i];
+	}
+
+	constexpr S* begin() const noexcept
+	{
+		return m_data;
+	}
+
+	constexpr S* end() const noexcept
+	{
+		return m_data + m_size;
+	}
+
+#if defined(__cpp_lib_span)
+	operator std::span<S>() const noexcept
+	{
+		return std::span<S>(m_data, m_size);
+	}
+#endif
+
+protected:
+
+	S*        m_data;
+	size_type m_size;
+};
+
+
+//PetscContainer destroy callback deleting an Owner. Same 3.23 signature change as the MATSHELL context destroy
+template<typename Owner>
+struct petsc_owner_destroy
+{
+#if PETSC_VERSION_GE(3, 23, 0)
+	static PetscErrorCode destroy(void** ctx)
+	{
+		delete static_cast<Owner*>(*ctx);
+		*ctx = NULL;
+		return 0;
+	}
+#else
+	static PetscErrorCode destroy(void* ctx)
+	{
+		delete static_cast<Owner*>(ctx);
+		return 0;
+	}
+#endif
+};
+
+/* ties owner's lifetime to obj's. owner is anything whose destructor lets go of some memory obj uses -- the
+ * std::unique_ptr, std::shared_ptr or std::vector that owns a buffer, a struct holding several of them, etc. It's
+ * moved into a PetscContainer composed with obj under key, and destroyed when obj is (i.e. when the last reference
+ * goes, whoever holds it, not when some particular handle does). Attaching under the same key again destroys the
+ * previous owner.
+ */
+template<typename Owner>
+PetscErrorCode petsc_attach_owner(PetscObject obj, Owner&& owner, const char key[]="petsc_smart_ptr_owner") noexcept
+{
+	PetscFunctionBegin;
+	using owner_type = typename std::decay<Owner>::type;
+	owner_type* keep = NULL;
+	try
+	{
+		keep = new owner_type(std::forward<Owner>(owner));
+	}
+	catch(...)
+	{
+		PetscFunctionReturn(PETSC_ERR_MEM);
+	}
+	PetscContainer container;
+	PetscErrorCode ierr = PetscContainerCreate(PETSC_COMM_SELF, &container);
+	if(ierr)
+	{
+		delete keep;
+		CHKERRQ(ierr);
+	}
+	ierr = PetscContainerSetPointer(container, keep);
+	if(not ierr)
+	{
+#if PETSC_VERSION_GE(3, 23, 0)
+		ierr = PetscContainerSetCtxDestroy(container, &petsc_owner_destroy<owner_type>::destroy);
+#else
+		ierr = PetscContainerSetUserDestroy(container, &petsc_owner_destroy<owner_type>::destroy);
+#endif
+	}
+	if(ierr)
+	{
+		delete keep;
+		PetscContainerDestroy(&container);
+		CHKERRQ(ierr);
+	}
+	//from here on the container deletes keep. Composing takes a reference, so ours goes right away
+	ierr = PetscObjectCompose(obj, key, (PetscObject)(container));
+	PetscErrorCode destroy_ierr = PetscContainerDestroy(&container);
+	CHKERRQ(ierr);
+	CHKERRQ(destroy_ierr);
+	PetscFunctionReturn(0);
+}
 
-//base class
+
+/* opt-in instrumentation: build with PETSC_SMART_PTR_LOG defined (and a PETSc configured with logging) and the
+ * handles register PetscLogEvents, per object type, for what they do on their own:
+ *
+ * MatHndlCreate/VecHndlCreate   new objects made by a handle
+ * MatHndlCopy/VecHndlCopy       handle copies (copy construction and copy assignment)
+ * MatHndlRef/VecHndlRef         PetscObjectReference()s taken by handles (copies, sharing a raw object, reset())
+ * MatHndlDestroy/VecHndlDestroy references dropped by handles
+ * MatHndlFlush                  petsc_mat_assembler flushes
+ * VecHndlArray                  array guard acquisitions
+ *
+ * They show up in -log_view like any other event, so the Count column is the number of times each happened
+ * (e.g. a high Copy count is handles being passed by value by accident). Without PETSC_SMART_PTR_LOG all of this
+ * is empty inline code and compiles away. Errors from the logging itself are ignored, so turning it on can't
+ * change what the program does.
+ */
 template<typename T>
+struct petsc_smart_ptr_log_traits;
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_Mat>
+{
+	static const char* name() noexcept
+	{
+		return "Mat";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return MAT_CLASSID;
+	}
+};
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_Vec>
+{
+	static const char* name() noexcept
+	{
+		return "Vec";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return VEC_CLASSID;
+	}
+};
+
+struct petsc_smart_ptr_log
+{
+	enum event {create, copy, reference, destroy, flush, array, num_events};
+
+#if defined(PETSC_SMART_PTR_LOG) && defined(PETSC_USE_LOG)
+	//the event for T, registered the first time it's needed
+	template<typename T>
+	static PetscLogEvent get(event e) noexcept
+	{
+		if(not registered<T>())
+		{
+			static const char* const suffix[num_events] = {"HndlCreate", "HndlCopy", "HndlRef", "HndlDestroy", "HndlFlush", "HndlArray"};
+			for(int k = 0; k < num_events; ++k)
+			{
+				const std::string name = std::string(petsc_smart_ptr_log_traits<T>::name()) + suffix[k];
+				PetscLogEventRegister(name.c_str(), petsc_smart_ptr_log_traits<T>::classid(), &events<T>()[k]);
+			}
+			//PetscFinalize() throws the events away, so register again if PETSc gets initialized again
+			PetscRegisterFinalize(&unregister<T>);
+			registered<T>() = true;
+		}
+		return events<T>()[e];
+	}
+
+	//logs e on obj for as long as it's alive
+	template<typename T>
+	class scope
+	{
+	public:
+
+		scope(event e, T* obj) noexcept : m_event(get<T>(e)), m_obj((PetscObject)(obj))
+		{
+			(void)PetscLogEventBegin(m_event, m_obj, 0, 0, 0);
+		};
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+		~scope() noexcept
+		{
+			(void)PetscLogEventEnd(m_event, m_obj, 0, 0, 0);
+		}
+
+	private:
+
+		PetscLogEvent m_event;
+		PetscObject   m_obj;
+	};
+
+private:
+
+	template<typename T>
+	static bool& registered() noexcept
+	{
+		static bool reg = false;
+		return reg;
+	}
+
+	template<typename T>
+	static PetscLogEvent* events() noexcept
+	{
+		static PetscLogEvent ev[num_events];
+		return ev;
+	}
+
+	template<typename T>
+	static PetscErrorCode unregister(void)
+	{
+		registered<T>() = false;
+		return 0;
+	}
+#else
+	template<typename T>
+	class scope
+	{
+	public:
+
+		constexpr scope(event, T*) noexcept
+		{};
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+	};
+#endif
+};
+
+
+/* opt-in leak and double-free tracking for debug builds: build with PETSC_SMART_PTR_TRACK defined and every
+ * reference a handle takes is counted, per object, in a fixed-size lock-free table (open addressing on the
+ * object's address, PETSC_SMART_PTR_TRACK_CAPACITY slots, a power of two), along with a backtrace of where the
+ * first handle got it. Then
+ *
+ * - a handle releasing an object that handles already destroyed (use after destroy), or one holding more
+ *   references than the object has left (somebody else destroyed a reference a handle owns) is an error, caught
+ *   before the release that would crash, instead of a corrupted heap hours later. Whether an object is gone is
+ *   kept in the table (the last handle to let go marks it), never read from the object, whose header may have
+ *   been freed
+ * - PetscFinalize() prints every object that handles still hold (leaks: they should all be gone by then), with
+ *   the backtrace, and the same checks for each
+ *
+ * Without PETSC_SMART_PTR_TRACK it's all empty inline functions and compiles away. Backtraces need glibc's (or
+ * macOS's) backtrace(), otherwise the reports just don't have them.
+ */
+struct petsc_smart_ptr_track
+{
+#if defined(PETSC_SMART_PTR_TRACK)
+	//counts a reference a handle took (a new handle, a copy, or an adopted object)
+	static void acquire(void* ptr) noexcept
+	{
+		if(not ptr)
+		{
+			return;
+		}
+		entry* e = find(ptr, true);
+		if(e and e->handles.fetch_add(1) == 0)
+		{
+			//a new object at a destroyed one's address. Racy if two threads share a fresh object at once, which
+			//only costs the backtrace
+			e->dead.store(false);
+			e->depth = capture(e->frames);
+		}
+		if(not finalize_registered().exchange(true))
+		{
+			PetscRegisterFinalize(&report);
+		}
+	}
+
+	//a handle is about to drop its reference to ptr: errors out instead if that can't be right
+	static PetscErrorCode release(void* ptr) noexcept
+	{
+		PetscFunctionBegin;
+		entry* e = find(ptr, false);
+		//untracked (the table was full, or a raw object a handle took over without us seeing it) can't be checked
+		if(not e)
+		{
+			PetscFunctionReturn(0);
+		}
+		PetscErrorCode ierr = check(ptr, e);CHKERRQ(ierr);
+		//ours is the last reference, so the object goes now (or onto a destroy queue, where no handle reaches it)
+		if(((PetscObject)(ptr))->refct == 1)
+		{
+			e->dead.store(true);
+		}
+		e->handles.fetch_sub(1);
+		PetscFunctionReturn(0);
+	}
+
+	//a handle gave its reference to the caller (release()): not ours to track anymore
+	static void forget(void* ptr) noexcept
+	{
+		entry* e = ptr ? find(ptr, false) : NULL;
+		if(e)
+		{
+			e->handles.fetch_sub(1);
+		}
+	}
+
+private:
+
+#if !defined(PETSC_SMART_PTR_TRACK_CAPACITY)
+#define PETSC_SMART_PTR_TRACK_CAPACITY 65536
+#endif
+	static constexpr std::size_t capacity = PETSC_SMART_PTR_TRACK_CAPACITY;
+	static constexpr int max_frames = 16;
+	static_assert((capacity & (capacity - 1)) == 0, "PETSC_SMART_PTR_TRACK_CAPACITY must be a power of two");
+
+	struct entry
+	{
+		std::atomic<void*>    obj;    //never cleared (until finalize), so probing never breaks
+		std::atomic<PetscInt> handles;//references held by handles
+		std::atomic<bool>     dead;   //the last handle destroyed it: the header mustn't be read
+		void*                 frames[max_frames];
+		int                   depth;
+	};
+
+	//zero-initialized, being static
+	static entry* table() noexcept
+	{
+		static entry entries[capacity];
+		return entries;
+	}
+
+	static std::atomic<bool>& finalize_registered() noexcept
+	{
+		static std::atomic<bool> registered(false);
+		return registered;
+	}
+
+	static std::atomic<bool>& overflowed() noexcept
+	{
+		static std::atomic<bool> full(false);
+		return full;
+	}
+
+	//ptr's entry, claiming a free one if insert. NULL if there's none (or the table is full)
+	static entry* find(void* ptr, bool insert) noexcept
+	{
+		entry* entries = table();
+		std::size_t h = (reinterpret_cast<std::uintptr_t>(ptr) >> 4)*0x9e3779b97f4a7c15ull;
+		for(std::size_t probe = 0; probe < capacity; ++probe, ++h)
+		{
+			entry& e = entries[h & (capacity - 1)];
+			void* cur = e.obj.load();
+			if(cur == ptr)
+			{
+				return &e;
+			}
+			if(not cur)
+			{
+				if(not insert)
+				{
+					return NULL;
+				}
+				if(e.obj.compare_exchange_strong(cur, ptr) or cur == ptr)
+				{
+					return &e;
+				}
+			}
+		}
+		if(insert and not overflowed().exchange(true))
+		{
+			(void)PetscInfo(NULL, "petsc_smart_ptr_track: table full, some handles aren't tracked\n");
+		}
+		return NULL;
+	}
+
+	static int capture(void** frames) noexcept
+	{
+#if defined(PETSC_SMART_PTR_HAVE_BACKTRACE)
+		return backtrace(frames, max_frames);
+#else
+		(void)frames;
+		return 0;
+#endif
+	}
+
+	static PetscErrorCode check(void* ptr, const entry* e) noexcept
+	{
+		PetscFunctionBegin;
+		if(e->dead.load())
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_MEMC, "use after destroy: a handle holds an object handles already destroyed");
+		}
+		//alive, so its header can be read
+		if(e->handles.load() > ((PetscObject)(ptr))->refct)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_MEMC, "refcount imbalance: handles hold more references than the object has");
+		}
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode report(void)
+	{
+		PetscFunctionBegin;
+		entry* entries = table();
+		for(std::size_t k = 0; k < capacity; ++k)
+		{
+			entry& e = entries[k];
+			void* ptr = e.obj.load();
+			if(ptr and e.handles.load() > 0)
+			{
+				const bool dead = e.dead.load();
+				const PetscObject obj = (PetscObject)(ptr);
+				(void)PetscFPrintf(PETSC_COMM_SELF, PETSC_STDERR, "petsc_smart_ptr_track: %s %p still held by %d handle(s) at PetscFinalize()%s\n",
+						   dead ? "destroyed object" : obj->class_name, ptr, (int)e.handles.load(),
+						   dead ? ", and already destroyed (use after destroy)" :
+						   e.handles.load() > obj->refct ? ", which hold more references than it has" : "");
+#if defined(PETSC_SMART_PTR_HAVE_BACKTRACE)
+				if(e.depth > 0)
+				{
+					(void)PetscFPrintf(PETSC_COMM_SELF, PETSC_STDERR, "first taken at:\n");
+					backtrace_symbols_fd(e.frames, e.depth, 2);
+				}
+#endif
+			}
+			//everything starts over if PETSc gets initialized again
+			e.obj.store(NULL);
+			e.handles.store(0);
+			e.dead.store(false);
+			e.depth = 0;
+		}
+		finalize_registered().store(false);
+		overflowed().store(false);
+		PetscFunctionReturn(0);
+	}
+#else
+	static void acquire(void*) noexcept
+	{}
+
+	static constexpr PetscErrorCode release(void*) noexcept
+	{
+		return 0;
+	}
+
+	static void forget(void*) noexcept
+	{}
+#endif
+};
+
+
+/* base class, CRTP style. Derived is the petsc_smart_ptr<T> specialization, and it has to provide
+ *
+ * static PetscErrorCode destroy_object(T** ptr) noexcept;
+ *
+ * which drops one reference to *ptr (the typed destroy, e.g. MatDestroy()) and nulls it. Everything else lives
+ * here. There are no virtual functions and the only member is the pointer, so a handle is exactly as big as the
+ * raw PETSc object (sizeof(petsc_smart_ptr<_p_Mat>) == sizeof(Mat)) and destruction can be inlined. Errors are
+ * reported through return values; constructors and the dtor can't return anything, so they print the usual
+ * PETSc traceback (CHKERRV) and leave the handle null.
+ */
+template<typename Derived, typename T, typename DestroyPolicy = petsc_default_destroy>
 class petsc_smart_ptr_base
 {
 public:
 
-	//make everything noexcept 'cuz PETSc objects don't play well w/ C++ exceptions (yet, at least!)
-	//ugly malloc call cuz we're doing manual memory management here. This default base ctor should really
-	//probably never be called though, so it doesn't matter so much anyway
-	petsc_smart_ptr_base() noexcept :
-								m_ptr(malloc(sizeof(T))),
-								m_ierr(0) 
+	//replace with `typedef T type` if we want to make compatible with old C++
+	using type = T;
+	using pointer = T*;
+	using destroy_policy = DestroyPolicy;
+
+
+	//returns raw pointer to the data
+	T* get() const noexcept
+	{
+		return m_ptr;
+	}
+
+	//sets the given raw pointer equal to m_ptr (no reference is taken)
+	PetscErrorCode get(T** ptr) const noexcept
+	{
+		PetscFunctionBeginHot;
+		*ptr = m_ptr;
+		PetscFunctionReturn(0);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_ptr != NULL;
+	}
+
+	//the object's (inner) communicator, MPI_COMM_NULL for a null handle. Not stored in the handle, see petsc_comm
+	MPI_Comm comm() const noexcept
+	{
+		return m_ptr ? PetscObjectComm((PetscObject)(m_ptr)) : MPI_COMM_NULL;
+	}
+
+
+	//gets the reference count of the object (0 for a null handle)
+	PetscInt refcount() const noexcept
+	{
+		PetscFunctionBegin;
+		PetscInt refcnt = 0;
+		if(m_ptr)
+		{
+			PetscObjectGetReference((PetscObject)(m_ptr), &refcnt);
+		}
+		PetscFunctionReturn(refcnt);
+	}
+
+	PetscErrorCode refcount(PetscInt* cnt) const noexcept
+	{
+		PetscFunctionBegin;
+		*cnt = 0;
+		if(m_ptr)
+		{
+			PetscErrorCode ierr = PetscObjectGetReference((PetscObject)(m_ptr), cnt);CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+
+	/* this means that if you have some PETSc object wrapped in a petsc_smart_ptr<SomePetscType>,
+	 * such as
+	 *
+	 * petsc_smart_ptr<SomePetscType> obj([some constructor info]);
+	 *
+	 * and want to access some member of obj, then doing
+	 *
+	 * auto thing = obj->attribute;
+	 *
+	 * is _the exact same thing_ as declaring a
+	 *
+	 * SomePetscType*  CStyleObj;
+	 *
+	 * doing all the memory allocation that the petsc_smart_ptr<SomePetscType> constructor does,
+	 * and then doing
+	 *
+	 * auto thing = CStyleObj->attribute;
+	 *
+	 * Like with a raw pointer, dereferencing a null handle is on you.
+	 */
+	T* operator->() const noexcept
+	{
+		return m_ptr;
+	}
+
+	T& operator*() const noexcept
+	{
+		return *m_ptr;
+	}
+
+
+	//drops our reference (if any) and leaves the handle null
+	PetscErrorCode reset() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = destroy();CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//drops our reference (if any) and shares ptr instead (takes a reference to it)
+	PetscErrorCode reset(T* ptr) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+		if(ptr)
+		{
+			ierr = reference(ptr);CHKERRQ(ierr);
+		}
+		ierr = destroy();CHKERRQ(ierr);
+		m_ptr = ptr;
+		PetscFunctionReturn(0);
+	}
+
+	//drops our reference (if any) and takes over the caller's reference to ptr
+	PetscErrorCode reset(T* ptr, petsc_adopt_t) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = destroy();CHKERRQ(ierr);
+		m_ptr = ptr;
+		petsc_smart_ptr_track::acquire(ptr);
+		PetscFunctionReturn(0);
+	}
+
+	//gives our reference to the caller (who now has to destroy it) and leaves the handle null
+	T* release() noexcept
+	{
+		T* ptr = m_ptr;
+		petsc_smart_ptr_track::forget(ptr);
+		m_ptr = NULL;
+		return ptr;
+	}
+
+	//exchanges the held objects without touching either one's refcount
+	void swap(Derived& ptr) noexcept
+	{
+		std::swap(m_ptr, static_cast<petsc_smart_ptr_base&>(ptr).m_ptr);
+	}
+
+
+protected:
+
+	constexpr petsc_smart_ptr_base() noexcept : m_ptr(NULL)
+	{};
+
+	//shares ptr: increments the object's ref count
+	explicit petsc_smart_ptr_base(T* ptr) noexcept : m_ptr(NULL)
+	{
+		PetscFunctionBeginHot;
+		if(ptr)
+		{
+			PetscErrorCode ierr = reference(ptr);CHKERRV(ierr);
+		}
+		m_ptr = ptr;
+		PetscFunctionReturnVoid();
+	};
+
+	//takes over a reference the caller already owns
+	petsc_smart_ptr_base(T* ptr, petsc_adopt_t) noexcept : m_ptr(ptr)
+	{
+		petsc_smart_ptr_track::acquire(ptr);
+	};
+
+	//call right after creating an object straight into m_ptr (XxxCreate(comm, &m_ptr)), which is taking it over
+	//just like the adopting constructor
+	void created() noexcept
+	{
+		petsc_smart_ptr_track::acquire(m_ptr);
+	}
+
+	//copy ctor -- the new handle holds its own reference
+	petsc_smart_ptr_base(const petsc_smart_ptr_base& ptr) noexcept : petsc_smart_ptr_base(ptr.m_ptr)
+	{
+		petsc_smart_ptr_log::scope<T> log(petsc_smart_ptr_log::copy, m_ptr);
+	};
+
+	//move ctor -- steals the pointer, so no PetscObjectReference/Dereference happens.
+	//ptr is left null, so its dtor is a no-op
+	petsc_smart_ptr_base(petsc_smart_ptr_base&& ptr) noexcept : m_ptr(ptr.m_ptr)
+	{
+		ptr.m_ptr = NULL;
+	}
+
+	petsc_smart_ptr_base& operator=(const petsc_smart_ptr_base& ptr) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_ptr != ptr.m_ptr)
+		{
+			petsc_smart_ptr_log::scope<T> log(petsc_smart_ptr_log::copy, ptr.m_ptr);
+			PetscErrorCode ierr = reset(ptr.m_ptr);CHKERRABORT(PETSC_COMM_SELF, ierr);
+		}
+		PetscFunctionReturn(*this);
+	}
+
+	//move assignment -- same as the move ctor, except the object we were holding gets released
+	petsc_smart_ptr_base& operator=(petsc_smart_ptr_base&& ptr) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(this != std::addressof(ptr))
+		{
+			//not reset(ptr.m_ptr, petsc_adopt): the reference (and its tracking entry) moves, nothing is acquired
+			PetscErrorCode ierr = destroy();CHKERRABORT(PETSC_COMM_SELF, ierr);
+			m_ptr = ptr.m_ptr;
+			ptr.m_ptr = NULL;
+		}
+		PetscFunctionReturn(*this);
+	}
+
+	//non-virtual: handles are never deleted through a pointer to the base
+	~petsc_smart_ptr_base() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = destroy();CHKERRV(ierr);//TODO: maybe use CHKERRABORT(comm, ierr) instead?
+		PetscFunctionReturnVoid();
+	}
+
+
+	T*		 m_ptr;//the object
+
+private:
+
+	//asks the policy whether we may let go, then does the typed destroy. m_ptr is null afterwards
+	PetscErrorCode destroy() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_ptr) //if m_ptr is not already nulled
+		{
+			//with petsc_fast_destroy this is a constant 0, so the whole check compiles away
+			PetscErrorCode ierr = DestroyPolicy::check(m_ptr);
+			//if there's an error, crash before deallocating anything
+			CHKERRQ(ierr);
+			ierr = petsc_smart_ptr_track::release(m_ptr);CHKERRQ(ierr);
+			//the object may be gone by the time the event ends, so it isn't logged with one
+			petsc_smart_ptr_log::scope<T> log(petsc_smart_ptr_log::destroy, NULL);
+			//PETSc destroys (and frees) the object itself once the count reaches zero
+			ierr = DestroyPolicy::release(&m_ptr, &Derived::destroy_object);CHKERRQ(ierr);
+			m_ptr = NULL;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//PetscObjectReference(), counted by the instrumentation
+	static PetscErrorCode reference(T* ptr) noexcept
+	{
+		PetscFunctionBeginHot;
+		petsc_smart_ptr_log::scope<T> log(petsc_smart_ptr_log::reference, ptr);
+		PetscErrorCode ierr = PetscObjectReference((PetscObject)(ptr));CHKERRQ(ierr);
+		petsc_smart_ptr_track::acquire(ptr);
+		PetscFunctionReturn(0);
+	}
+
+};//class petsc_smart_ptr_base
+
+
+//base template (type deduction fails, it's a type we haven't implemented yet)
+template<typename T, typename DestroyPolicy = petsc_default_destroy>
+class petsc_smart_ptr
+{
+	//sizeof(T) is never 0, but the condition has to depend on T so that it only fires on instantiation
+	static_assert(sizeof(T) == 0, "petsc_smart_ptr<T> is only implemented for the PETSc types it is specialized for");
+};
+
+/* RAII guard over MatGetLocalSubMatrix(): a view of the (isrow, iscol) block of a matrix, addressed with local
+ * indices, that inserts straight into the parent's storage (for a MATNEST parent it's the block itself, otherwise
+ * typically a light-weight wrapper). Nothing is copied. MatRestoreLocalSubMatrix() happens on destruction (or on
+ * restore()), so values set through get() are in the parent once the guard is gone, and the parent still has to be
+ * assembled as usual.
+ *
+ * The guard borrows the parent and the index sets (no references are taken), so they have to outlive it. If
+ * getting the submatrix failed, the guard is null.
+ */
+class petsc_local_submatrix
+{
+public:
+
+	petsc_local_submatrix() noexcept : m_parent(NULL), m_isrow(NULL), m_iscol(NULL), m_sub(NULL)
+	{};
+
+	petsc_local_submatrix(Mat parent, IS isrow, IS iscol) noexcept : petsc_local_submatrix()
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = acquire(parent, isrow, iscol);CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	};
+
+	petsc_local_submatrix(const petsc_local_submatrix&) = delete;
+	petsc_local_submatrix& operator=(const petsc_local_submatrix&) = delete;
+
+	petsc_local_submatrix(petsc_local_submatrix&& sub) noexcept :
+		m_parent(sub.m_parent), m_isrow(sub.m_isrow), m_iscol(sub.m_iscol), m_sub(sub.m_sub)
+	{
+		sub.m_parent = NULL;
+		sub.m_sub = NULL;
+	}
+
+	petsc_local_submatrix& operator=(petsc_local_submatrix&& sub) noexcept
+	{
+		PetscFunctionBeginHot;
+		if(this != std::addressof(sub))
+		{
+			PetscErrorCode ierr = restore();CHKERRABORT(PETSC_COMM_SELF, ierr);
+			std::swap(m_parent, sub.m_parent);
+			std::swap(m_isrow, sub.m_isrow);
+			std::swap(m_iscol, sub.m_iscol);
+			std::swap(m_sub, sub.m_sub);
+		}
+		PetscFunctionReturn(*this);
+	}
+
+	~petsc_local_submatrix() noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRV(ierr);
+		PetscFunctionReturnVoid();
+	}
+
+	//restores whatever we hold, then gets parent's (isrow, iscol) block
+	PetscErrorCode acquire(Mat parent, IS isrow, IS iscol) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = restore();CHKERRQ(ierr);
+		ierr = MatGetLocalSubMatrix(parent, isrow, iscol, &m_sub);CHKERRQ(ierr);
+		m_parent = parent;
+		m_isrow = isrow;
+		m_iscol = iscol;
+		PetscFunctionReturn(0);
+	}
+
+	//gives the submatrix back early; the guard is null afterwards
+	PetscErrorCode restore() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_parent)
+		{
+			PetscErrorCode ierr = MatRestoreLocalSubMatrix(m_parent, m_isrow, m_iscol, &m_sub);CHKERRQ(ierr);
+			m_parent = NULL;
+			m_sub = NULL;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//the view, for MatSetValuesLocal() and friends. Only valid while the guard holds it
+	Mat get() const noexcept
+	{
+		return m_sub;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_parent != NULL;
+	}
+
+private:
+
+	Mat m_parent;//borrowed
+	IS  m_isrow; //borrowed
+	IS  m_iscol; //borrowed
+	Mat m_sub;
+};
+
+
+
+//matrix type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_Mat, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_Mat, DestroyPolicy>, _p_Mat, DestroyPolicy>
+{
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_Mat, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing matrix (takes a reference to it)
+	explicit petsc_smart_ptr(Mat ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing matrix
+	petsc_smart_ptr(Mat ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+	//creates a new matrix on comm
+	explicit petsc_smart_ptr(MPI_Comm comm) noexcept : petsc_smart_ptr_base()
+	{
+		PetscFunctionBeginHot;
+		petsc_smart_ptr_log::scope<_p_Mat> log(petsc_smart_ptr_log::create, NULL);
+		PetscErrorCode ierr = MatCreate(comm, &m_ptr);CHKERRV(ierr);
+		this->created();
+		PetscFunctionReturnVoid();
+	};
+
+	petsc_smart_ptr(MPI_Comm comm, const std::string& mat_t) noexcept : petsc_smart_ptr(comm)
+	{
+		PetscFunctionBeginHot;
+		if(m_ptr)
+		{
+			PetscErrorCode ierr = set_type(mat_t);CHKERRV(ierr);
+		}
+		PetscFunctionReturnVoid();
+	};
+
+	//same, for a type name that's already a C string (e.g. MATAIJ), so no std::string gets built
+	petsc_smart_ptr(MPI_Comm comm, MatType mat_t) noexcept : petsc_smart_ptr(comm)
+	{
+		PetscFunctionBeginHot;
+		if(m_ptr)
+		{
+			PetscErrorCode ierr = set_type(mat_t);CHKERRV(ierr);
+		}
+		PetscFunctionReturnVoid();
+	};
+
+
+	PetscErrorCode set_type(const std::string& mat_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MatSetType(m_ptr, mat_t.c_str());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_type(MatType mat_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MatSetType(m_ptr, mat_t);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_sizes(PetscInt m, PetscInt n, PetscInt M=PETSC_DETERMINE, PetscInt N=PETSC_DETERMINE) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MatSetSizes(m_ptr, m, n, M, N);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	/* COO assembly, for when the nonzero pattern stays put and only the values change. Register the (i, j)
+	 * pattern once with set_preallocation_coo(), then every assembly is a single set_values_coo() with the values
+	 * in the same order. PETSc does the sorting/hashing once up front; each assembly after that is a linear copy
+	 * (done on the device for GPU matrix types). set_values_coo() leaves the matrix assembled, so no
+	 * MatAssemblyBegin/End is needed. Needs PETSc >= 3.17.
+	 *
+	 * The pattern's length is composed with the Mat, and set_values_coo() refuses a v of any other length rather
+	 * than letting PETSc read past it. A pattern registered some other way (MatSetPreallocationCOO() itself, or
+	 * MatDuplicate() of a COO matrix) has no length on record, and v isn't checked then.
+	 */
+	PetscErrorCode set_preallocation_coo(petsc_array_view<const PetscInt> i, petsc_array_view<const PetscInt> j) noexcept
 	{
-		PetscFunctionBeginHot;
-		//check that malloc worked (m_ptr is not null)
-		if(not m_ptr)
+		PetscFunctionBegin;
+		if(i.size() != j.size())
 		{
-			m_ierr = PETSC_ERR_MEM;
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "COO row and column index arrays must be the same length");
 		}
-		
-		CHKERRQ(m_ierr);
-
-		PetscFunctionReturnVoid();
-	};
+		//PETSc is allowed to scribble on the index arrays, so hand it copies. This only happens once per pattern
+		PetscInt* coo_i;
+		PetscInt* coo_j;
+		PetscErrorCode ierr = PetscMalloc2(i.size(), &coo_i, j.size(), &coo_j);CHKERRQ(ierr);
+		std::copy(i.begin(), i.end(), coo_i);
+		std::copy(j.begin(), j.end(), coo_j);
+		ierr = MatSetPreallocationCOO(m_ptr, static_cast<PetscCount>(i.size()), coo_i, coo_j);
+		PetscErrorCode free_ierr = PetscFree2(coo_i, coo_j);
+		CHKERRQ(ierr);
+		CHKERRQ(free_ierr);
+		//replaces a previous pattern's length
+		ierr = petsc_attach_owner((PetscObject)(m_ptr), static_cast<PetscCount>(i.size()), coo_count_key());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
 
-	petsc_smart_ptr_base(T& ptr) noexcept : m_ptr(std::addressof(ptr))
+	//v holds one value per (i, j) pair given to set_preallocation_coo(), in the same order
+	PetscErrorCode set_values_coo(petsc_array_view<const PetscScalar> v, InsertMode mode=INSERT_VALUES) noexcept
 	{
 		PetscFunctionBeginHot;
-		//TODO: should I do this?
-		//increment the object's ref count
-		m_ierr = PetscObjectReference((PetscObject)(m_ptr))
-		//TODO: maybe some conditions to see if things look okay? (not sure exactly what that means yet)
-		CHKERRQ(m_ierr);
-
-		PetscFunctionReturnVoid();
-	};
+		PetscContainer container;
+		PetscErrorCode ierr = PetscObjectQuery((PetscObject)(m_ptr), coo_count_key(), (PetscObject*)(&container));CHKERRQ(ierr);
+		if(container)
+		{
+			void* count;
+			ierr = PetscContainerGetPointer(container, &count);CHKERRQ(ierr);
+			if(static_cast<PetscCount>(v.size()) != *static_cast<PetscCount*>(count))
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "COO values must match the preallocated pattern's length");
+			}
+		}
+		ierr = MatSetValuesCOO(m_ptr, v.data(), mode);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
 
-	petsc_smart_ptr_base(T* ptr) noexcept : m_ptr(ptr)
-	{
-		PetscFunctionBeginHot;
-		//TODO: same as above
-		m_ierr = PetscObjectReference((PetscObject)(m_ptr))
-		CHKERRQ(m_ierr);
 
-		PetscFunctionReturnVoid();
-	};
+	/* submatrices. Roughly from cheapest to most expensive:
+	 *
+	 * nest_block()          block (i, j) of a MATNEST, which is a Mat of its own already: no copy at all
+	 * get_local_submatrix() a view for inserting into the (isrow, iscol) block in place, see petsc_local_submatrix
+	 * create_submatrix()    a real (copied) submatrix, for when a solver needs one of its own. Handing it the
+	 *                       same handle again refreshes it in place with MAT_REUSE_MATRIX, so repeated extraction
+	 *                       (e.g. a fieldsplit every Newton step) copies values but doesn't allocate
+	 */
 
-		//copy ctor -- ptr is not const cuz we increment its pointer's refcount
-	petsc_smart_ptr_base(petsc_smart_ptr_base& ptr) noexcept : m_ptr(ptr.m_ptr), m_ierr(ptr.m_ierr)
+	//shares block (i, j) of a MATNEST (takes a reference, so it stays valid even if the nest goes away).
+	//*block is null for an empty block
+	PetscErrorCode nest_block(PetscInt i, PetscInt j, petsc_smart_ptr* block) const noexcept
 	{
-		PetscFunctionBeginHot;
-		//TODO: same as above
-		m_ierr = PetscObjectReference((PetscObject)(ptr));
-		CHKERRQ(m_ierr);
+		PetscFunctionBegin;
+		Mat sub;
+		PetscErrorCode ierr = MatNestGetSubMat(m_ptr, i, j, &sub);CHKERRQ(ierr);
+		ierr = block->reset(sub);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
 
-		PetscFunctionReturnVoid();
-	};	
+	petsc_local_submatrix get_local_submatrix(IS isrow, IS iscol) const noexcept
+	{
+		return petsc_local_submatrix(m_ptr, isrow, iscol);
+	}
 
-	//move ctor
-	petsc_smart_ptr_base(petsc_smart_ptr_base&& ptr) noexcept : m_ptr(ptr.m_ptr), m_ierr(ptr.m_ierr)
+	//MatCreateSubMatrix() into *sub: MAT_INITIAL_MATRIX if it's null, otherwise MAT_REUSE_MATRIX, which requires
+	//*sub to have come from an earlier call with the same index sets (values may have changed, the pattern not).
+	//Everybody holding *sub's object sees the refresh
+	PetscErrorCode create_submatrix(IS isrow, IS iscol, petsc_smart_ptr* sub) const noexcept
 	{
-		PetscFunctionBeginHot;
-		//destroy the other pointer
-		ptr.~petsc_smart_ptr_base();
-		PetscFunctionReturnVoid;
+		PetscFunctionBegin;
+		PetscErrorCode ierr;
+		if(*sub)
+		{
+			Mat B = sub->get();
+			ierr = MatCreateSubMatrix(m_ptr, isrow, iscol, MAT_REUSE_MATRIX, &B);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+		Mat B;
+		ierr = MatCreateSubMatrix(m_ptr, isrow, iscol, MAT_INITIAL_MATRIX, &B);CHKERRQ(ierr);
+		ierr = sub->reset(B, petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
-		
 
-	//replace with `typedef T type` if we want to make compatible with old C++
-	using type = T;
-	
-	//overload to send m_ierr to whichever process requests it
-	void request_ierr(PetscError& ierr) const noexcept
+	//MatView()/MatLoad() through viewer, e.g. one from petsc_viewer.hpp, whose binary and HDF5 viewers write and
+	//read collectively so every rank streams its own rows. load() needs a created matrix; type and sizes may be
+	//left unset, in which case they come from the file
+	PetscErrorCode save(PetscViewer viewer) const noexcept
 	{
 		PetscFunctionBegin;
-		ierr = m_ierr;
-		PetscFunctionReturnVoid();
+		PetscErrorCode ierr = MatView(m_ptr, viewer);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
-	PetscError request_ierr() const noexcept
+	PetscErrorCode load(PetscViewer viewer) noexcept
 	{
 		PetscFunctionBegin;
-		PetscFunctionReturn(m_ierr);
+		PetscErrorCode ierr = MatLoad(m_ptr, viewer);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
 
-	//returns raw pointer to the data
-	T* get() noexcept
+	/* zero-copy matrices over CSR arrays that are already there (e.g. owned by the application). PETSc uses the
+	 * arrays in place -- no copy, no preallocation -- so they have to stay alive, and keep their sparsity pattern,
+	 * as long as the Mat does. Either make sure of that yourself, or pass an owner (see petsc_attach_owner()),
+	 * which then goes away together with the Mat:
+	 *
+	 * petsc_smart_ptr<_p_Mat> A;
+	 * ierr = petsc_smart_ptr<_p_Mat>::create_with_arrays(PETSC_COMM_SELF, n, i, j, a, &A, std::move(csr));CHKERRQ(ierr);
+	 *
+	 * (std::vector's move keeps its data(), so i, j and a still point at csr's storage.) The number of local rows
+	 * is i.size() - 1.
+	 */
+
+	//MatCreateSeqAIJWithArrays(): comm has to be a single process, n is the number of columns
+	static PetscErrorCode create_with_arrays(MPI_Comm comm, PetscInt n, petsc_array_view<PetscInt> i, petsc_array_view<PetscInt> j,
+						 petsc_array_view<PetscScalar> a, petsc_smart_ptr* mat) noexcept
 	{
-		PetscFunctionBeginHot;
-		PetscFunctionReturn(m_ptr);
-	
+		PetscFunctionBegin;
+		PetscErrorCode ierr = check_csr(i, j, a);CHKERRQ(ierr);
+		Mat A;
+		ierr = MatCreateSeqAIJWithArrays(comm, static_cast<PetscInt>(i.size() - 1), n, i.data(), j.data(), a.data(), &A);CHKERRQ(ierr);
+		ierr = mat->reset(A, petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
-	//sets the given raw pointer equal to m_ptr
-	PetscError get(T* ptr) noexcept
+	template<typename Owner>
+	static PetscErrorCode create_with_arrays(MPI_Comm comm, PetscInt n, petsc_array_view<PetscInt> i, petsc_array_view<PetscInt> j,
+						 petsc_array_view<PetscScalar> a, petsc_smart_ptr* mat, Owner&& owner) noexcept
 	{
-		PetscFunctionBeginHot;
-		ptr = m_ptr;
+		PetscFunctionBegin;
+		petsc_smart_ptr A;
+		PetscErrorCode ierr = create_with_arrays(comm, n, i, j, a, &A);CHKERRQ(ierr);
+		ierr = petsc_attach_owner((PetscObject)(A.m_ptr), std::forward<Owner>(owner));CHKERRQ(ierr);
+		ierr = mat->reset(A.release(), petsc_adopt);CHKERRQ(ierr);
 		PetscFunctionReturn(0);
 	}
 
-
-	//gets the reference count of the object
-	PetscInt refcount() noexcept
+	//MatCreateMPIAIJWithSplitArrays(): the diagonal block (i, j, a) and the off-diagonal block (oi, oj, oa) of the
+	//local rows, with the index conventions that function documents. n is the number of local columns
+	static PetscErrorCode create_with_split_arrays(MPI_Comm comm, PetscInt n, PetscInt M, PetscInt N,
+						       petsc_array_view<PetscInt> i, petsc_array_view<PetscInt> j, petsc_array_view<PetscScalar> a,
+						       petsc_array_view<PetscInt> oi, petsc_array_view<PetscInt> oj, petsc_array_view<PetscScalar> oa,
+						       petsc_smart_ptr* mat) noexcept
 	{
 		PetscFunctionBegin;
-		PetscInt refcnt;
-
-		PetscObjectGetReference((PetscObject)(m_ptr), &refcnt);
-
-		PetscFunctionReturn(refcnt);
+		PetscErrorCode ierr = check_csr(i, j, a);CHKERRQ(ierr);
+		ierr = check_csr(oi, oj, oa);CHKERRQ(ierr);
+		if(oi.size() != i.size())
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "diagonal and off-diagonal blocks must have the same number of rows");
+		}
+		Mat A;
+		ierr = MatCreateMPIAIJWithSplitArrays(comm, static_cast<PetscInt>(i.size() - 1), n, M, N, i.data(), j.data(), a.data(),
+						      oi.data(), oj.data(), oa.data(), &A);CHKERRQ(ierr);
+		ierr = mat->reset(A, petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
-	PetscError refcount(PetscInt* cnt) noexcept
+	template<typename Owner>
+	static PetscErrorCode create_with_split_arrays(MPI_Comm comm, PetscInt n, PetscInt M, PetscInt N,
+						       petsc_array_view<PetscInt> i, petsc_array_view<PetscInt> j, petsc_array_view<PetscScalar> a,
+						       petsc_array_view<PetscInt> oi, petsc_array_view<PetscInt> oj, petsc_array_view<PetscScalar> oa,
+						       petsc_smart_ptr* mat, Owner&& owner) noexcept
 	{
 		PetscFunctionBegin;
-		PetscObjectReference((PetscObject)(m_ptr), cnt);
+		petsc_smart_ptr A;
+		PetscErrorCode ierr = create_with_split_arrays(comm, n, M, N, i, j, a, oi, oj, oa, &A);CHKERRQ(ierr);
+		ierr = petsc_attach_owner((PetscObject)(A.m_ptr), std::forward<Owner>(owner));CHKERRQ(ierr);
+		ierr = mat->reset(A.release(), petsc_adopt);CHKERRQ(ierr);
 		PetscFunctionReturn(0);
 	}
 
 
-	/* this means that if you have some PETSc object wrapped in a petsc_smart_ptr<SomePetscType>,
-	 * such as
-	 *
-	 * petsc_smart_ptr<SomePetscType> obj([some constructor info]);
-	 *
-	 * and want to access some member of obj, then doing
-	 *
-	 * auto thing = obj->attribute;
-	 *
-	 * is _the exact same thing_ as declaring a 
-	 *
-	 * SomePetscType*  CStyleObj;
+	/* matrix-free MATSHELL whose MatMult(A, x, y) calls mult(x, y), which returns a PetscErrorCode:
 	 *
-	 * doing all the memory allocation that the petsc_smart_ptr<SomePetscType> constructor does,
-	 * and then doing
+	 * auto A = petsc_smart_ptr<_p_Mat>::make_shell(comm, {m, m, M, M}, [&](Vec x, Vec y) { return apply(x, y); });
 	 *
-	 * auto thing = CStyleObj->attribute;
+	 * mult is moved (or copied) into the shell's context and called directly through a thunk instantiated for its
+	 * type, so there's no std::function and the call can be inlined. The context lives as long as the Mat (not
+	 * just this handle: a KSP holding the operator keeps it alive too) and is deleted by MatDestroy(). Exceptions
+	 * thrown by mult come back out of MatMult() as PETSC_ERR_LIB. A null handle means creation failed (the
+	 * traceback is printed, and nothing is left behind).
 	 */
-	T* operator->() noexcept
+	template<typename F>
+	static petsc_smart_ptr make_shell(MPI_Comm comm, const petsc_mat_sizes& sizes, F&& mult) noexcept
 	{
-		PetscFunctionBeginHot;
-		if(m_ptr == NULL)
+		PetscFunctionBegin;
+		using callable = typename std::decay<F>::type;
+		petsc_smart_ptr A;
+		callable* ctx = NULL;
+		try
 		{
-			//NOTE: maybe add a CHKERRQ here? seems more like something the user should have control over though,
-			// as much as one has any control once one dereferences a null pointer...
-			m_ierr = PETSC_ERR_POINTER;
+			ctx = new callable(std::forward<F>(mult));
 		}
-
-		PetscFunctionReturn(m_ptr);
+		catch(...)
+		{
+			PetscFunctionReturn(make_shell_failed(PETSC_ERR_MEM, __LINE__, PETSC_ERROR_INITIAL));
+		}
+		PetscErrorCode ierr = MatCreateShell(comm, sizes.m, sizes.n, sizes.M, sizes.N, ctx, &A.m_ptr);
+		if(ierr)
+		{
+			delete ctx;
+			A.m_ptr = NULL;
+			PetscFunctionReturn(make_shell_failed(ierr, __LINE__));
+		}
+		A.created();
+		ierr = MatShellSetContextDestroy(A.m_ptr, &shell_context_destroy<callable>);
+		if(ierr)
+		{
+			//the shell doesn't own ctx yet
+			delete ctx;
+			(void)A.reset();
+			PetscFunctionReturn(make_shell_failed(ierr, __LINE__));
+		}
+		//from here on MatDestroy() cleans up ctx
+		ierr = MatShellSetOperation(A.m_ptr, MATOP_MULT, (void (*)(void))(&shell_mult<callable>));
+		if(ierr)
+		{
+			(void)A.reset();
+			PetscFunctionReturn(make_shell_failed(ierr, __LINE__));
+		}
+		PetscFunctionReturn(A);
 	}
 
-	const T* operator->() const noexcept
+	//same, for a multiply known at compile time: Mult is installed as MatMult itself, no context or thunk.
+	//ctx is available to it through MatShellGetContext()
+	template<PetscErrorCode (*Mult)(Mat, Vec, Vec)>
+	static petsc_smart_ptr make_shell(MPI_Comm comm, const petsc_mat_sizes& sizes, void* ctx=NULL) noexcept
 	{
-		PetscFunctionBeginHot;
-		if(m_ptr == NULL)
+		PetscFunctionBegin;
+		petsc_smart_ptr A;
+		PetscErrorCode ierr = MatCreateShell(comm, sizes.m, sizes.n, sizes.M, sizes.N, ctx, &A.m_ptr);
+		if(ierr)
 		{
-			m_ierr = PETSC_ERR_POINTER;
+			A.m_ptr = NULL;
+			PetscFunctionReturn(make_shell_failed(ierr, __LINE__));
 		}
-
-		PetscFunctionReturn(m_ptr);
+		A.created();
+		ierr = MatShellSetOperation(A.m_ptr, MATOP_MULT, (void (*)(void))(Mult));
+		if(ierr)
+		{
+			(void)A.reset();
+			PetscFunctionReturn(make_shell_failed(ierr, __LINE__));
+		}
+		PetscFunctionReturn(A);
 	}
-			
 
-	T& operator*() noexcept
+
+	//typed destroy used by the base class. Moves are pointer steals, and MatDestroy() on a null Mat is a no-op,
+	//so e.g. std::vector<petsc_smart_ptr<_p_Mat>> can grow without touching any refcounts
+	static PetscErrorCode destroy_object(Mat* ptr) noexcept
 	{
-		PetscFunctionBeginHot;
-		PetscFunctionReturn(*m_ptr);
+		//m_ptr is a _p_Mat*, so no overloaded operator&()
+		return MatDestroy(ptr);
 	}
 
-	const T& operator() const noexcept
+private:
+
+	//where set_preallocation_coo() keeps the pattern's length
+	static const char* coo_count_key() noexcept
 	{
-		PetscFunctionBeginHot;
-		PetscFunctionReturn(*m_ptr);
+		return "petsc_smart_ptr_coo_count";
 	}
 
-	virtual ~petsc_smart_ptr_base() noexcept
+	//row pointers, column indices and values that at least agree with each other
+	static PetscErrorCode check_csr(petsc_array_view<PetscInt> i, petsc_array_view<PetscInt> j, petsc_array_view<PetscScalar> a) noexcept
 	{
 		PetscFunctionBegin;
-
-		if(m_ptr) //if m_ptr is not already nulled
+		if(i.empty())
 		{
-		//anybody else have a problem and trying to tell us? if so, we can't delete. This shouldn't 
-		//affect performance meaningfully, since generally, destructors for PETSc objects will be called at
-		//the end of a (segment of a) computation, when new data is relatively more likely to be loaded anyway
-		PetscInt flag;
-		MPI_Status stat;//in case flag is true
-		MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_SELF, &flag, &stat);
-		
-		if(flag){
-			//TODO: implement this (the case where there is some incoming message)
-			m_ierr = PETSC_ERR_SIG;
-		}
-		//if there's an error, crash before deallocating anything
-		CHKERRQ(m_ierr);
-		m_ierr = PetscObjectDereference((PetscObject)(m_ptr));
-		//check that the object isn't being referenced by anyone else
-		m_ierr = refcount(&flag);
-		if(not m_ierr)//if the refcount is zero
-		{
-			PetscFree(m_ptr);
-			//if that didn't work...
-			if(m_ptr){
-				m_ierr = PETSC_ERR_WRONGSTATE;
-			}
-		} 
-		else
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "CSR row pointer array needs one entry more than there are rows");
+		}
+		if(j.size() != a.size() or static_cast<std::size_t>(i[i.size() - 1]) != j.size())
 		{
-			//some error, for now, just continue without freeing object, re-increment the refcount
-			m_ierr = PetscObjectReference((PetscObject)(m_ptr));	
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_SIZ, "CSR column index and value arrays must both have i[m] entries");
 		}
-		//make sure we don't need to crash (again)
-		CHKERRQ(m_ierr);//TODO: maybe use CHKERRABORT(comm, m_ierr) instead?
+		PetscFunctionReturn(0);
+	}
 
-		PetscFunctionReturnVoid();
+	//what CHKERRV would print, for make_shell(), which can't return the error: it gives back a null handle instead
+	static petsc_smart_ptr make_shell_failed(PetscErrorCode ierr, int line, PetscErrorType type=PETSC_ERROR_REPEAT) noexcept
+	{
+		(void)PetscError(PETSC_COMM_SELF, line, "make_shell", __FILE__, ierr, type, type == PETSC_ERROR_INITIAL ?
+				 "couldn't allocate the shell context" : " ");
+		return petsc_smart_ptr();
+	}
+
+	template<typename F>
+	static PetscErrorCode shell_mult(Mat A, Vec x, Vec y)
+	{
+		PetscFunctionBeginHot;
+		F* mult;
+		PetscErrorCode ierr = MatShellGetContext(A, &mult);CHKERRQ(ierr);
+		try
+		{
+			ierr = (*mult)(x, y);CHKERRQ(ierr);
+		}
+		catch(...)
+		{
+			//don't let exceptions unwind through PETSc's C frames
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "exception thrown by a shell matrix multiply");
 		}
+		PetscFunctionReturn(0);
 	}
 
-	
+	//the context destroy callback went from taking the context to taking its address in PETSc 3.23
+#if PETSC_VERSION_GE(3, 23, 0)
+	template<typename F>
+	static PetscErrorCode shell_context_destroy(void** ctx)
+	{
+		delete static_cast<F*>(*ctx);
+		*ctx = NULL;
+		return 0;
+	}
+#else
+	template<typename F>
+	static PetscErrorCode shell_context_destroy(void* ctx)
+	{
+		delete static_cast<F*>(ctx);
+		return 0;
+	}
+#endif
+};
 
 
-protected:
 
-	//error code for operations on the object
-	PetscError m_ierr;
+/* access modes for petsc_vec_array. Each one picks the Get/Restore pair and the constness of the elements.
+ * petsc_vec_write is the one to use when every entry gets overwritten: VecGetArrayWrite() doesn't have to bring
+ * the current values over, so e.g. a CUDA vector skips the device-to-host copy.
+ */
+struct petsc_vec_read_write
+{
+	using scalar = PetscScalar;
 
-	T*		 m_ptr;//the object
+	static PetscErrorCode get(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecGetArray(vec, arr);
+	}
 
-};//class petsc_smart_ptr_base
+	static PetscErrorCode restore(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecRestoreArray(vec, arr);
+	}
+};
 
+struct petsc_vec_read
+{
+	using scalar = const PetscScalar;
 
-//base template (type deduction fails, it's a type we haven't implemented yet)
-template<typename T>
-class petsc_smart_ptr : private petsc_smart_ptr_base<T>
+	static PetscErrorCode get(Vec vec, const PetscScalar** arr) noexcept
+	{
+		return VecGetArrayRead(vec, arr);
+	}
+
+	static PetscErrorCode restore(Vec vec, const PetscScalar** arr) noexcept
+	{
+		return VecRestoreArrayRead(vec, arr);
+	}
+};
+
+struct petsc_vec_write
+{
+	using scalar = PetscScalar;
+
+	static PetscErrorCode get(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecGetArrayWrite(vec, arr);
+	}
+
+	static PetscErrorCode restore(Vec vec, PetscScalar** arr) noexcept
+	{
+		return VecRestoreArrayWrite(vec, arr);
+	}
+};
+
+
+/* RAII guard over a Vec's local array: gets it on construction, restores it on destruction (or on restore()).
+ * It's a petsc_array_view, so loops over it are plain loops over contiguous memory, e.g.
+ *
+ * auto x_arr = x.get_array_read();
+ * auto y_arr = y.get_array();
+ * for(std::size_t i = 0; i < y_arr.size(); ++i) y_arr[i] += 2.0*x_arr[i];
+ *
+ * The guard borrows the Vec (no reference is taken), so the Vec has to outlive it. If getting the array failed,
+ * the guard is null (and empty).
+ */
+template<typename Access>
+class petsc_vec_array : public petsc_array_view<typename Access::scalar>
 {
+	using petsc_array_view = ::petsc_array_view<typename Access::scalar>;
+	using petsc_array_view::m_data;
+	using petsc_array_view::m_size;
 
 public:
 
-	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base() 
+	using access = Access;
+
+	petsc_vec_array() noexcept : petsc_array_view(), m_vec(NULL)
+	{};
+
+	explicit petsc_vec_array(Vec vec) noexcept : petsc_array_view(), m_vec(NULL)
 	{
 		PetscFunctionBeginHot;
-		m_ierr = PETSC_ERR_SUP;
-		CHKERRQ(m_ierr);
+		PetscErrorCode ierr = acquire(vec);CHKERRV(ierr);
 		PetscFunctionReturnVoid();
 	};
 
-	petsc_smart_ptr(const T& ptr) noexcept : petsc_smart_ptr_base(ptr) 
+	petsc_vec_array(const petsc_vec_array&) = delete;
+	petsc_vec_array& operator=(const petsc_vec_array&) = delete;
+
+	petsc_vec_array(petsc_vec_array&& arr) noexcept : petsc_array_view(arr.m_data, arr.m_size), m_vec(arr.m_vec)
+	{
+		arr.m_vec = NULL;
+		arr.m_data = NULL;
+		arr.m_size = 0;
+	}
+
+	petsc_vec_array& operator=(petsc_vec_array&& arr) noexcept
 	{
 		PetscFunctionBeginHot;
-		m_ierr = PETSC_ERR_SUP;
-		CHKERRQ(m_ierr);
-		PetscFunctionReturnVoid();
-	};
+		if(this != std::addressof(arr))
+		{
+			PetscErrorCode ierr = restore();CHKERRABORT(PETSC_COMM_SELF, ierr);
+			std::swap(m_vec, arr.m_vec);
+			std::swap(m_data, arr.m_data);
+			std::swap(m_size, arr.m_size);
+		}
+		PetscFunctionReturn(*this);
+	}
 
-	petsc_smart_ptr(const T* ptr) noexcept : petsc_smart_ptr_base(ptr) 
+	~petsc_vec_array() noexcept
 	{
 		PetscFunctionBeginHot;
-		m_ierr = PETSC_ERR_SUP;
-		CHKERRQ(m_ierr);
+		PetscErrorCode ierr = restore();CHKERRV(ierr);
 		PetscFunctionReturnVoid();
-	};
-	
+	}
 
-	~petsc_smart_ptr() noexcept
+	//restores whatever we hold, then gets vec's array
+	PetscErrorCode acquire(Vec vec) noexcept
 	{
 		PetscFunctionBeginHot;
-		//nothing to do here, base dtor takes care of it
-		PetscFunctionReturnVoid();
+		PetscErrorCode ierr = restore();CHKERRQ(ierr);
+		petsc_smart_ptr_log::scope<_p_Vec> log(petsc_smart_ptr_log::array, vec);
+		PetscInt n;
+		ierr = VecGetLocalSize(vec, &n);CHKERRQ(ierr);
+		typename Access::scalar* arr;
+		ierr = Access::get(vec, &arr);CHKERRQ(ierr);
+		m_vec = vec;
+		m_data = arr;
+		m_size = static_cast<std::size_t>(n);
+		PetscFunctionReturn(0);
+	}
+
+	//gives the array back early; the guard is null afterwards
+	PetscErrorCode restore() noexcept
+	{
+		PetscFunctionBeginHot;
+		if(m_vec)
+		{
+			typename Access::scalar* arr = m_data;
+			PetscErrorCode ierr = Access::restore(m_vec, &arr);CHKERRQ(ierr);
+			m_vec = NULL;
+			m_data = NULL;
+			m_size = 0;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return m_vec != NULL;
 	}
+
+private:
+
+	Vec m_vec;//borrowed
 };
 
 
 
-//matrix type specialization
-using _p_Mat = struct _p_Mat;//'cuz C has typedef structs for some stupid reason
-template<>
-class petsc_smart_ptr<_p_Mat> : petsc_smart_ptr_base<_p_Mat>
+//extension point for petsc_vec_expr.hpp: expression types that a Vec handle can be assigned from. An expression
+//type has a PetscErrorCode evaluate(Vec w) const noexcept that writes its value into w
+template<typename Expr>
+struct petsc_is_vec_expr : std::false_type
+{};
+
+
+//vector type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_Vec, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_Vec, DestroyPolicy>, _p_Vec, DestroyPolicy>
 {
-	//takes pointer to matrix struct
-	petsc_smart_ptr(Mat ptr, MPI_Comm comm=PETSC_COMM_WORLD) : petsc_smart_ptr_base(ptr)
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_Vec, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing vector (takes a reference to it)
+	explicit petsc_smart_ptr(Vec ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing vector
+	petsc_smart_ptr(Vec ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+	//creates a new vector on comm
+	explicit petsc_smart_ptr(MPI_Comm comm) noexcept : petsc_smart_ptr_base()
 	{
 		PetscFunctionBeginHot;
-		MatCreate(comm, &m_ptr);
-		CHKERRQ(m_ierr);
+		petsc_smart_ptr_log::scope<_p_Vec> log(petsc_smart_ptr_log::create, NULL);
+		PetscErrorCode ierr = VecCreate(comm, &m_ptr);CHKERRV(ierr);
+		this->created();
 		PetscFunctionReturnVoid();
 	};
 
-	petsc_smart_ptr(Mat ptr, MPI_Comm comm=PETSC_COMM_WORLD, const std::string& mat_t) : petsc_smart_ptr_base(ptr)
+	petsc_smart_ptr(MPI_Comm comm, const std::string& vec_t) noexcept : petsc_smart_ptr(comm)
 	{
 		PetscFunctionBeginHot;
-		MatCreate(comm, &m_ptr)
-		m_ierr = set_type(mat_t);
-		CHKERRQ(m_ierr);
+		if(m_ptr)
+		{
+			PetscErrorCode ierr = set_type(vec_t);CHKERRV(ierr);
+		}
 		PetscFunctionReturnVoid();
 	};
-		
 
-	void set_type(const std::string& mat_t)
+	//same, for a type name that's already a C string (e.g. VECSTANDARD), so no std::string gets built
+	petsc_smart_ptr(MPI_Comm comm, VecType vec_t) noexcept : petsc_smart_ptr(comm)
 	{
-		PetscFunctionBegin;
-		MatSetType(m_ptr, mat_t);
+		PetscFunctionBeginHot;
+		if(m_ptr)
+		{
+			PetscErrorCode ierr = set_type(vec_t);CHKERRV(ierr);
+		}
 		PetscFunctionReturnVoid();
+	};
+
+
+	PetscErrorCode set_type(const std::string& vec_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecSetType(m_ptr, vec_t.c_str());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
 	}
 
-	
-	~petsc_smart_ptr()
+	PetscErrorCode set_type(VecType vec_t) noexcept
 	{
-		//m_ptr is a _p_Mat*, so no overloaded operator&()
-		MatDestroy(&m_ptr);
-		//base dtor does the rest
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecSetType(m_ptr, vec_t);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_sizes(PetscInt n, PetscInt N=PETSC_DETERMINE) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecSetSizes(m_ptr, n, N);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode local_size(PetscInt* n) const noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = VecGetLocalSize(m_ptr, n);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	/* zero-copy vector over array (its local entries; bs is the block size, N the global size or PETSC_DECIDE),
+	 * with VecCreateMPIWithArray(). array is used in place, so it has to outlive the Vec -- or pass an owner (see
+	 * petsc_attach_owner()), which then goes away together with the Vec.
+	 */
+	static PetscErrorCode create_with_array(MPI_Comm comm, PetscInt bs, petsc_array_view<PetscScalar> array, PetscInt N,
+						petsc_smart_ptr* vec) noexcept
+	{
+		PetscFunctionBegin;
+		Vec v;
+		PetscErrorCode ierr = VecCreateMPIWithArray(comm, bs, static_cast<PetscInt>(array.size()), N, array.data(), &v);CHKERRQ(ierr);
+		ierr = vec->reset(v, petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	template<typename Owner>
+	static PetscErrorCode create_with_array(MPI_Comm comm, PetscInt bs, petsc_array_view<PetscScalar> array, PetscInt N,
+						petsc_smart_ptr* vec, Owner&& owner) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_smart_ptr v;
+		PetscErrorCode ierr = create_with_array(comm, bs, array, N, &v);CHKERRQ(ierr);
+		ierr = petsc_attach_owner((PetscObject)(v.m_ptr), std::forward<Owner>(owner));CHKERRQ(ierr);
+		ierr = vec->reset(v.release(), petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//new vector with the same layout and type (values are not copied)
+	PetscErrorCode duplicate(petsc_smart_ptr* vec) const noexcept
+	{
+		PetscFunctionBegin;
+		petsc_smart_ptr_log::scope<_p_Vec> log(petsc_smart_ptr_log::create, m_ptr);
+		Vec dup;
+		PetscErrorCode ierr = VecDuplicate(m_ptr, &dup);CHKERRQ(ierr);
+		ierr = vec->reset(dup, petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//VecView()/VecLoad() through viewer, same as the matrix ones. For HDF5 the dataset is the vector's name
+	//(PetscObjectSetName()), so set it before saving and before loading
+	PetscErrorCode save(PetscViewer viewer) const noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecView(m_ptr, viewer);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode load(PetscViewer viewer) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = VecLoad(m_ptr, viewer);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	//w = a*x + b*y - c*z and friends, see petsc_vec_expr.hpp. Only participates for expression types, so
+	//handle-to-handle assignment is still the usual copy/move
+	template<typename Expr, typename = typename std::enable_if<petsc_is_vec_expr<Expr>::value>::type>
+	petsc_smart_ptr& operator=(const Expr& expr) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = assign(expr);CHKERRABORT(PETSC_COMM_SELF, ierr);
+		PetscFunctionReturn(*this);
+	}
+
+	//same as operator=, but reports errors instead of aborting on them
+	template<typename Expr, typename = typename std::enable_if<petsc_is_vec_expr<Expr>::value>::type>
+	PetscErrorCode assign(const Expr& expr) noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = expr.evaluate(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	//RAII views of the local array, see petsc_vec_array
+	petsc_vec_array<petsc_vec_read_write> get_array() noexcept
+	{
+		return petsc_vec_array<petsc_vec_read_write>(m_ptr);
+	}
+
+	petsc_vec_array<petsc_vec_read> get_array_read() const noexcept
+	{
+		return petsc_vec_array<petsc_vec_read>(m_ptr);
+	}
+
+	//for overwriting every entry; the current values may not be there
+	petsc_vec_array<petsc_vec_write> get_array_write() noexcept
+	{
+		return petsc_vec_array<petsc_vec_write>(m_ptr);
+	}
+
+
+	//typed destroy used by the base class
+	static PetscErrorCode destroy_object(Vec* ptr) noexcept
+	{
+		return VecDestroy(ptr);
 	}
 };
 
 
 
-//petsc typedefs _p_Mat* to mat (typdef struct _p_Mat* Mat), and this class should hold a pointer to
-// _p_Mat, not a pointer-to-pointer-to _p_Mat
-using petsc_smart_ptr<Mat> = petsc_smart_ptr<_p_Mat>;
+//petsc typedefs _p_Mat* to Mat (typdef struct _p_Mat* Mat), and petsc_smart_ptr should hold a pointer to
+// _p_Mat, not a pointer-to-pointer-to _p_Mat. petsc_handle lets you spell it with the C typedef instead,
+//i.e. petsc_handle<Mat> is petsc_smart_ptr<_p_Mat> (same for Vec)
+template<typename T, typename DestroyPolicy = petsc_default_destroy>
+using petsc_handle = petsc_smart_ptr<typename std::remove_pointer<T>::type, DestroyPolicy>;
+
+static_assert(sizeof(petsc_smart_ptr<_p_Mat>) == sizeof(Mat), "Mat handles must be as small as a raw Mat");
+static_assert(sizeof(petsc_smart_ptr<_p_Vec>) == sizeof(Vec), "Vec handles must be as small as a raw Vec");
 
 #endif //PETSC_SMART_PTR_HPP
@@ -0,0 +1,643 @@
+#ifndef PETSC_SOLVER_HPP
+#define PETSC_SOLVER_HPP
+
+#include "petsc_smart_ptr.hpp"
+extern "C" {
+#include <petscksp.h>
+#include <petscsnes.h>
+#include <petsc/private/pcimpl.h>//struct _p_PC
+#include <petsc/private/kspimpl.h>//struct _p_KSP
+#include <petsc/private/snesimpl.h>//struct _p_SNES
+}
+#include <memory>
+
+
+
+/* solver handles (KSP, PC, SNES) that keep track of what happened to the preconditioning matrix since the
+ * preconditioner was last built, so transient runs don't rebuild it (e.g. a whole AMG hierarchy) when they don't
+ * have to. Every setup compares the matrix's object state and nonzero state with the ones recorded last time:
+ *
+ * petsc_same_operator     nothing changed (only the right-hand side did): PETSc's own setup is a no-op
+ * petsc_same_pattern      values changed: the old preconditioner is reused through PCSetReusePreconditioner()
+ *                         for up to set_reuse_lag() setups in a row, then rebuilt
+ * petsc_different_pattern new matrix or new nonzero pattern: always rebuilt
+ *
+ * With the default lag of 0 that's exactly PETSc's behaviour (rebuild whenever the values change), so reuse is
+ * opt-in, since a stale preconditioner costs iterations. The record lives on the PC (see petsc_setup_tracker),
+ * so a KSP handle, a handle to its PC and the SNES it belongs to all see the same one.
+ */
+
+
+enum petsc_operator_change {petsc_same_operator, petsc_same_pattern, petsc_different_pattern};
+
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_KSP>
+{
+	static const char* name() noexcept
+	{
+		return "KSP";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return KSP_CLASSID;
+	}
+};
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_PC>
+{
+	static const char* name() noexcept
+	{
+		return "PC";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return PC_CLASSID;
+	}
+};
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_SNES>
+{
+	static const char* name() noexcept
+	{
+		return "SNES";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return SNES_CLASSID;
+	}
+};
+
+
+/* what a PC was last set up with, and how often it was rebuilt or reused. Composed with the PC under
+ * petsc_setup_tracker::key(), created the first time of() is asked for it.
+ */
+class petsc_setup_tracker
+{
+public:
+
+	static const char* key() noexcept
+	{
+		return "petsc_smart_ptr_setup_tracker";
+	}
+
+	petsc_setup_tracker() noexcept :
+		m_pmat_id(-1), m_state(0), m_nonzero_state(0), m_max_lag(0), m_lag(0), m_rebuilds(0), m_reuses(0),
+		m_reusing(PETSC_FALSE), m_built_state(0)
+	{};
+
+	//pc's tracker, attaching a fresh one if it doesn't have one yet
+	static PetscErrorCode of(PC pc, petsc_setup_tracker** tracker) noexcept
+	{
+		PetscFunctionBegin;
+		PetscContainer container;
+		PetscErrorCode ierr = PetscObjectQuery((PetscObject)(pc), key(), (PetscObject*)(&container));CHKERRQ(ierr);
+		if(container)
+		{
+			void* ptr;
+			ierr = PetscContainerGetPointer(container, &ptr);CHKERRQ(ierr);
+			*tracker = static_cast<petsc_setup_tracker*>(ptr);
+			PetscFunctionReturn(0);
+		}
+		std::unique_ptr<petsc_setup_tracker> fresh(new (std::nothrow) petsc_setup_tracker());
+		if(not fresh)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_MEM, "couldn't allocate a setup tracker");
+		}
+		*tracker = fresh.get();
+		ierr = petsc_attach_owner((PetscObject)(pc), std::move(fresh), key());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	/* call right before pc gets set up with preconditioning matrix pmat (NULL if it has none yet): compares pmat
+	 * with what was recorded last time, sets PCSetReusePreconditioner() accordingly and records pmat's current
+	 * state. change (if not NULL) says what it found.
+	 */
+	PetscErrorCode update(PC pc, Mat pmat, petsc_operator_change* change=NULL) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_operator_change found = petsc_different_pattern;
+		PetscInt64       id = -1;
+		PetscObjectState state = 0, nonzero_state = 0;
+		PetscErrorCode   ierr;
+#if defined(PETSC_USE_DEBUG)
+		//PCSetUp() leaves pc->matstate alone when it reuses the preconditioner, so if it moved, the reuse asked for
+		//last time got overridden somewhere (e.g. by SNES's own lag) and rebuilds()/reuses() are lying
+		if(m_reusing and pc->setupcalled and pc->matstate != m_built_state)
+		{
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_PLIB, "the preconditioner was rebuilt although its reuse was requested");
+		}
+#endif
+		if(pmat)
+		{
+			ierr = PetscObjectGetId((PetscObject)(pmat), &id);CHKERRQ(ierr);
+			ierr = PetscObjectStateGet((PetscObject)(pmat), &state);CHKERRQ(ierr);
+			ierr = MatGetNonzeroState(pmat, &nonzero_state);CHKERRQ(ierr);
+			//ids are never reused, so a different matrix at the same address counts as different
+			if(id == m_pmat_id and nonzero_state == m_nonzero_state)
+			{
+				found = state == m_state ? petsc_same_operator : petsc_same_pattern;
+			}
+		}
+
+		if(found == petsc_same_pattern and m_lag < m_max_lag)
+		{
+			ierr = PCSetReusePreconditioner(pc, PETSC_TRUE);CHKERRQ(ierr);
+			++m_lag;
+			++m_reuses;
+			m_reusing = PETSC_TRUE;
+			m_built_state = pc->matstate;
+		}
+		else if(found != petsc_same_operator)
+		{
+			ierr = PCSetReusePreconditioner(pc, PETSC_FALSE);CHKERRQ(ierr);
+			m_lag = 0;
+			++m_rebuilds;
+			m_reusing = PETSC_FALSE;
+		}
+		m_pmat_id = id;
+		m_state = state;
+		m_nonzero_state = nonzero_state;
+		if(change)
+		{
+			*change = found;
+		}
+		PetscFunctionReturn(0);
+	}
+
+	//reuse the preconditioner for up to max_lag consecutive value changes (0, the default, never reuses it;
+	//PETSC_MAX_INT reuses it until the pattern changes)
+	void set_max_lag(PetscInt max_lag) noexcept
+	{
+		m_max_lag = max_lag;
+	}
+
+	PetscInt max_lag() const noexcept
+	{
+		return m_max_lag;
+	}
+
+	//times update() let the preconditioner be rebuilt / kept it despite changed values
+	PetscInt rebuilds() const noexcept
+	{
+		return m_rebuilds;
+	}
+
+	PetscInt reuses() const noexcept
+	{
+		return m_reuses;
+	}
+
+	//whether the last update() left the PC set to reuse its preconditioner
+	PetscBool reusing() const noexcept
+	{
+		return m_reusing;
+	}
+
+private:
+
+	PetscInt64       m_pmat_id;//-1 until the first update
+	PetscObjectState m_state;
+	PetscObjectState m_nonzero_state;
+	PetscInt         m_max_lag;
+	PetscInt         m_lag;    //reuses since the last rebuild
+	PetscInt         m_rebuilds;
+	PetscInt         m_reuses;
+	PetscBool        m_reusing;
+	PetscObjectState m_built_state;//pc->matstate when reuse was last asked for
+};
+
+//runs pc's tracker against its current preconditioning matrix (if it has one)
+inline PetscErrorCode petsc_track_setup(PC pc, petsc_operator_change* change=NULL) noexcept
+{
+	PetscFunctionBegin;
+	petsc_setup_tracker* tracker;
+	PetscErrorCode ierr = petsc_setup_tracker::of(pc, &tracker);CHKERRQ(ierr);
+	PetscBool mat_set, pmat_set;
+	ierr = PCGetOperatorsSet(pc, &mat_set, &pmat_set);CHKERRQ(ierr);
+	Mat pmat = NULL;
+	if(pmat_set)
+	{
+		//PCGetOperators() would create empty matrices if they weren't set
+		ierr = PCGetOperators(pc, NULL, &pmat);CHKERRQ(ierr);
+	}
+	ierr = tracker->update(pc, pmat, change);CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+inline PetscErrorCode petsc_set_reuse_lag(PC pc, PetscInt max_lag) noexcept
+{
+	PetscFunctionBegin;
+	petsc_setup_tracker* tracker;
+	PetscErrorCode ierr = petsc_setup_tracker::of(pc, &tracker);CHKERRQ(ierr);
+	tracker->set_max_lag(max_lag);
+	PetscFunctionReturn(0);
+}
+
+
+
+//preconditioner type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_PC, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_PC, DestroyPolicy>, _p_PC, DestroyPolicy>
+{
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_PC, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing preconditioner (takes a reference to it)
+	explicit petsc_smart_ptr(PC ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing preconditioner
+	petsc_smart_ptr(PC ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+	//creates a new preconditioner on comm
+	explicit petsc_smart_ptr(MPI_Comm comm) noexcept : petsc_smart_ptr_base()
+	{
+		PetscFunctionBeginHot;
+		petsc_smart_ptr_log::scope<_p_PC> log(petsc_smart_ptr_log::create, NULL);
+		PetscErrorCode ierr = PCCreate(comm, &m_ptr);CHKERRV(ierr);
+		this->created();
+		PetscFunctionReturnVoid();
+	};
+
+
+	PetscErrorCode set_type(const std::string& pc_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = PCSetType(m_ptr, pc_t.c_str());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_from_options() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = PCSetFromOptions(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_operators(Mat A, Mat P) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = PCSetOperators(m_ptr, A, P);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_reuse_lag(PetscInt max_lag) noexcept
+	{
+		return petsc_set_reuse_lag(m_ptr, max_lag);
+	}
+
+	//PCSetUp(), rebuilding only what the tracker says has to be rebuilt
+	PetscErrorCode setup(petsc_operator_change* change=NULL) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = petsc_track_setup(m_ptr, change);CHKERRQ(ierr);
+		ierr = PCSetUp(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode apply(Vec x, Vec y) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = setup();CHKERRQ(ierr);
+		ierr = PCApply(m_ptr, x, y);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode tracker(petsc_setup_tracker** tracker) const noexcept
+	{
+		return petsc_setup_tracker::of(m_ptr, tracker);
+	}
+
+
+	//typed destroy used by the base class
+	static PetscErrorCode destroy_object(PC* ptr) noexcept
+	{
+		return PCDestroy(ptr);
+	}
+};
+
+
+
+//linear solver type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_KSP, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_KSP, DestroyPolicy>, _p_KSP, DestroyPolicy>
+{
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_KSP, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing solver (takes a reference to it)
+	explicit petsc_smart_ptr(KSP ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing solver
+	petsc_smart_ptr(KSP ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+	//creates a new solver on comm
+	explicit petsc_smart_ptr(MPI_Comm comm) noexcept : petsc_smart_ptr_base()
+	{
+		PetscFunctionBeginHot;
+		petsc_smart_ptr_log::scope<_p_KSP> log(petsc_smart_ptr_log::create, NULL);
+		PetscErrorCode ierr = KSPCreate(comm, &m_ptr);CHKERRV(ierr);
+		this->created();
+		PetscFunctionReturnVoid();
+	};
+
+
+	PetscErrorCode set_type(const std::string& ksp_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = KSPSetType(m_ptr, ksp_t.c_str());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_from_options() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = KSPSetFromOptions(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//new operators (or the same ones with new values) for the next setup. Setting the same matrices again is
+	//fine; whether the preconditioner gets rebuilt is decided at setup, from what actually changed
+	PetscErrorCode set_operators(Mat A, Mat P) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = KSPSetOperators(m_ptr, A, P);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//shares the solver's preconditioner
+	template<typename PCDestroyPolicy>
+	PetscErrorCode get_pc(petsc_smart_ptr<_p_PC, PCDestroyPolicy>* pc) const noexcept
+	{
+		PetscFunctionBegin;
+		PC raw;
+		PetscErrorCode ierr = KSPGetPC(m_ptr, &raw);CHKERRQ(ierr);
+		ierr = pc->reset(raw);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_reuse_lag(PetscInt max_lag) noexcept
+	{
+		PetscFunctionBegin;
+		PC pc;
+		PetscErrorCode ierr = KSPGetPC(m_ptr, &pc);CHKERRQ(ierr);
+		ierr = petsc_set_reuse_lag(pc, max_lag);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//KSPSetUp(), rebuilding the preconditioner only if the tracker says so
+	PetscErrorCode setup(petsc_operator_change* change=NULL) noexcept
+	{
+		PetscFunctionBegin;
+		PC pc;
+		PetscErrorCode ierr = KSPGetPC(m_ptr, &pc);CHKERRQ(ierr);
+		ierr = petsc_track_setup(pc, change);CHKERRQ(ierr);
+		ierr = KSPSetUp(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//setup() and KSPSolve()
+	PetscErrorCode solve(Vec b, Vec x) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = setup();CHKERRQ(ierr);
+		ierr = KSPSolve(m_ptr, b, x);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode tracker(petsc_setup_tracker** tracker) const noexcept
+	{
+		PetscFunctionBegin;
+		PC pc;
+		PetscErrorCode ierr = KSPGetPC(m_ptr, &pc);CHKERRQ(ierr);
+		ierr = petsc_setup_tracker::of(pc, tracker);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	//typed destroy used by the base class
+	static PetscErrorCode destroy_object(KSP* ptr) noexcept
+	{
+		return KSPDestroy(ptr);
+	}
+};
+
+
+
+//nonlinear solver type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_SNES, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_SNES, DestroyPolicy>, _p_SNES, DestroyPolicy>
+{
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_SNES, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing solver (takes a reference to it)
+	explicit petsc_smart_ptr(SNES ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing solver
+	petsc_smart_ptr(SNES ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+	//creates a new solver on comm
+	explicit petsc_smart_ptr(MPI_Comm comm) noexcept : petsc_smart_ptr_base()
+	{
+		PetscFunctionBeginHot;
+		petsc_smart_ptr_log::scope<_p_SNES> log(petsc_smart_ptr_log::create, NULL);
+		PetscErrorCode ierr = SNESCreate(comm, &m_ptr);CHKERRV(ierr);
+		this->created();
+		PetscFunctionReturnVoid();
+	};
+
+
+	PetscErrorCode set_type(const std::string& snes_t) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = SNESSetType(m_ptr, snes_t.c_str());CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_from_options() noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = SNESSetFromOptions(m_ptr);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	/* J and P are filled in by jac(SNES, Vec x, Mat J, Mat P), which returns a PetscErrorCode. Right after it
+	 * has run, the tracker compares P with what the preconditioner was last built from, so a Jacobian whose values
+	 * moved a little keeps the old preconditioner for up to set_reuse_lag() Newton steps (and time steps: the
+	 * record isn't reset between solves), while a new pattern always rebuilds it. jac is moved (or copied) into
+	 * storage owned by the SNES; exceptions come back out as PETSC_ERR_LIB.
+	 *
+	 * SNESComputeJacobian() sets the KSP's reuse flag from the SNES's preconditioner lag after the callback
+	 * returns, so the tracker's decision goes through SNESSetLagPreconditioner() (-1 to keep the preconditioner,
+	 * 1 to rebuild it): the tracker owns the lag from here on, and -snes_lag_preconditioner has no effect.
+	 */
+	template<typename F>
+	PetscErrorCode set_jacobian(Mat J, Mat P, F&& jac) noexcept
+	{
+		PetscFunctionBegin;
+		using callable = typename std::decay<F>::type;
+		std::unique_ptr<callable> ctx;
+		try
+		{
+			ctx.reset(new callable(std::forward<F>(jac)));
+		}
+		catch(...)
+		{
+			PetscFunctionReturn(PETSC_ERR_MEM);
+		}
+		//attached before the SNES gets to see it, so a failed attach can't leave it calling a deleted callable.
+		//Attaching replaces (and deletes) a previous set_jacobian()'s callable
+		callable* raw = ctx.get();
+		PetscObject previous;
+		PetscErrorCode ierr = PetscObjectQuery((PetscObject)(m_ptr), jacobian_key(), &previous);CHKERRQ(ierr);
+		ierr = petsc_attach_owner((PetscObject)(m_ptr), std::move(ctx), jacobian_key());
+		if(ierr)
+		{
+			//the attach may have failed before or after it let go of the previous callable: keep the SNES
+			//pointing at whichever one is still alive, or at none
+			PetscObject current = NULL;
+			(void)PetscObjectQuery((PetscObject)(m_ptr), jacobian_key(), &current);
+			if(current and current != previous)
+			{
+				(void)SNESSetJacobian(m_ptr, J, P, &jacobian<callable>, raw);
+			}
+			else if(not current and previous)
+			{
+				//a NULL routine would keep the old one, so put in one that says what happened
+				(void)SNESSetJacobian(m_ptr, J, P, &lost_jacobian, NULL);
+			}
+			CHKERRQ(ierr);
+		}
+		ierr = SNESSetJacobian(m_ptr, J, P, &jacobian<callable>, raw);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//shares the solver's linear solver
+	template<typename KSPDestroyPolicy>
+	PetscErrorCode get_ksp(petsc_smart_ptr<_p_KSP, KSPDestroyPolicy>* ksp) const noexcept
+	{
+		PetscFunctionBegin;
+		KSP raw;
+		PetscErrorCode ierr = SNESGetKSP(m_ptr, &raw);CHKERRQ(ierr);
+		ierr = ksp->reset(raw);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode set_reuse_lag(PetscInt max_lag) noexcept
+	{
+		PetscFunctionBegin;
+		PC pc;
+		PetscErrorCode ierr = get_pc(m_ptr, &pc);CHKERRQ(ierr);
+		ierr = petsc_set_reuse_lag(pc, max_lag);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//b may be NULL (solving F(x) = 0)
+	PetscErrorCode solve(Vec b, Vec x) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = SNESSolve(m_ptr, b, x);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode tracker(petsc_setup_tracker** tracker) const noexcept
+	{
+		PetscFunctionBegin;
+		PC pc;
+		PetscErrorCode ierr = get_pc(m_ptr, &pc);CHKERRQ(ierr);
+		ierr = petsc_setup_tracker::of(pc, tracker);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+
+	//typed destroy used by the base class
+	static PetscErrorCode destroy_object(SNES* ptr) noexcept
+	{
+		return SNESDestroy(ptr);
+	}
+
+private:
+
+	static const char* jacobian_key() noexcept
+	{
+		return "petsc_smart_ptr_jacobian";
+	}
+
+	static PetscErrorCode get_pc(SNES snes, PC* pc) noexcept
+	{
+		PetscFunctionBegin;
+		KSP ksp;
+		PetscErrorCode ierr = SNESGetKSP(snes, &ksp);CHKERRQ(ierr);
+		ierr = KSPGetPC(ksp, pc);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	static PetscErrorCode lost_jacobian(SNES, Vec, Mat, Mat, void*)
+	{
+		PetscFunctionBegin;
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ORDER, "the Jacobian was lost to a failed set_jacobian()");
+	}
+
+	template<typename F>
+	static PetscErrorCode jacobian(SNES snes, Vec x, Mat J, Mat P, void* ctx)
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr;
+		try
+		{
+			ierr = (*static_cast<F*>(ctx))(snes, x, J, P);CHKERRQ(ierr);
+		}
+		catch(...)
+		{
+			//don't let exceptions unwind through PETSc's C frames
+			SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "exception thrown by a Jacobian evaluation");
+		}
+		PC pc;
+		ierr = get_pc(snes, &pc);CHKERRQ(ierr);
+		petsc_setup_tracker* tracker;
+		ierr = petsc_setup_tracker::of(pc, &tracker);CHKERRQ(ierr);
+		ierr = tracker->update(pc, P);CHKERRQ(ierr);
+		//SNES would overwrite a PCSetReusePreconditioner() right after this returns; its lag is what it applies
+		ierr = SNESSetLagPreconditioner(snes, tracker->reusing() ? -1 : 1);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+};
+
+static_assert(sizeof(petsc_smart_ptr<_p_KSP>) == sizeof(KSP), "KSP handles must be as small as a raw KSP");
+static_assert(sizeof(petsc_smart_ptr<_p_PC>) == sizeof(PC), "PC handles must be as small as a raw PC");
+static_assert(sizeof(petsc_smart_ptr<_p_SNES>) == sizeof(SNES), "SNES handles must be as small as a raw SNES");
+
+#endif //PETSC_SOLVER_HPP
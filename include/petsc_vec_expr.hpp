@@ -0,0 +1,329 @@
+#ifndef PETSC_VEC_EXPR_HPP
+#define PETSC_VEC_EXPR_HPP
+
+#include "petsc_smart_ptr.hpp"
+#include <array>
+
+
+
+/* lazy linear combinations of Vec handles. Scaling, adding and subtracting handles builds a
+ * petsc_vec_lincomb<N> (N terms of coefficient * Vec, N known at compile time) instead of doing any work, and
+ * assigning it to a Vec handle evaluates it in (at most) one pass over memory:
+ *
+ * w = a*x + b*y - c*z;//one fused loop instead of a copy/scale and two VecAXPY()s
+ * y = y + alpha*p;    //VecAXPY
+ * w = x + y;          //VecWAXPY
+ *
+ * If w itself shows up on the right-hand side with one or two other terms, the update is a single VecAXPBY or
+ * VecAXPBYPCZ. Otherwise host vectors get a fused loop over their borrowed local arrays (the term count is a
+ * template argument, so the inner loop unrolls and the outer one vectorizes), and non-host (e.g. GPU) vectors use
+ * VecWAXPY/VecAXPBYPCZ, or VecAXPBY/VecScale + VecMAXPY (two passes) for more terms, so PETSc's device kernels do
+ * the work.
+ *
+ * An expression borrows the Vecs it refers to, so evaluate it within the lifetime of the handles (i.e. don't keep
+ * one around in an auto variable past them). All the Vecs need the same layout.
+ */
+template<std::size_t N>
+class petsc_vec_lincomb
+{
+public:
+
+	static constexpr std::size_t size = N;
+
+	petsc_vec_lincomb(const std::array<PetscScalar, N>& coef, const std::array<Vec, N>& vec) noexcept :
+		m_coef(coef), m_vec(vec)
+	{};
+
+	const std::array<PetscScalar, N>& coefficients() const noexcept
+	{
+		return m_coef;
+	}
+
+	const std::array<Vec, N>& vecs() const noexcept
+	{
+		return m_vec;
+	}
+
+
+	//w = sum_k m_coef[k]*m_vec[k]
+	PetscErrorCode evaluate(Vec w) const noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr;
+
+		//pull w's own terms out and merge repeated Vecs: w = w_coef*w + sum_k a[k]*x[k] with the x[k] all
+		//different (PETSc rejects identical arguments to VecAXPBY() and friends)
+		PetscScalar            w_coef = 0;
+		bool                   aliased = false;
+		std::array<PetscScalar, N> a;
+		std::array<Vec, N>     x;
+		PetscInt               n = 0;
+		for(std::size_t k = 0; k < N; ++k)
+		{
+			if(m_vec[k] == w)
+			{
+				w_coef += m_coef[k];
+				aliased = true;
+				continue;
+			}
+			PetscInt same = 0;
+			while(same < n and x[same] != m_vec[k])
+			{
+				++same;
+			}
+			if(same == n)
+			{
+				a[n] = 0;
+				x[n] = m_vec[k];
+				++n;
+			}
+			a[same] += m_coef[k];
+		}
+
+		if(aliased)
+		{
+			if(n == 0)
+			{
+				if(w_coef != PetscScalar(1))
+				{
+					ierr = VecScale(w, w_coef);CHKERRQ(ierr);
+				}
+			}
+			else if(n == 1)
+			{
+				ierr = VecAXPBY(w, a[0], w_coef, x[0]);CHKERRQ(ierr);
+			}
+			else if(n == 2)
+			{
+				ierr = VecAXPBYPCZ(w, a[0], a[1], w_coef, x[0], x[1]);CHKERRQ(ierr);
+			}
+			else if(w_coef == PetscScalar(1))
+			{
+				ierr = VecMAXPY(w, n, a.data(), x.data());CHKERRQ(ierr);
+			}
+			else
+			{
+				PetscBool host;
+				ierr = on_host(w, &host);CHKERRQ(ierr);
+				if(host)
+				{
+					ierr = fused_update(w, w_coef, a, x, n);CHKERRQ(ierr);
+				}
+				else
+				{
+					//VecMAXPY() only adds to w, so the scale is a pass of its own
+					ierr = VecScale(w, w_coef);CHKERRQ(ierr);
+					ierr = VecMAXPY(w, n, a.data(), x.data());CHKERRQ(ierr);
+				}
+			}
+			PetscFunctionReturn(0);
+		}
+
+		//w isn't read from here on (and n >= 1)
+		if(n == 1 and a[0] == PetscScalar(1))
+		{
+			ierr = VecCopy(x[0], w);CHKERRQ(ierr);
+			PetscFunctionReturn(0);
+		}
+		PetscBool host;
+		ierr = on_host(w, &host);CHKERRQ(ierr);
+		if(host)
+		{
+			//the unmerged terms, so the term count stays a compile-time constant
+			ierr = fused(w);CHKERRQ(ierr);
+		}
+		else if(n == 2 and a[1] == PetscScalar(1))
+		{
+			ierr = VecWAXPY(w, a[0], x[0], x[1]);CHKERRQ(ierr);
+		}
+		else if(n == 2 and a[0] == PetscScalar(1))
+		{
+			ierr = VecWAXPY(w, a[1], x[1], x[0]);CHKERRQ(ierr);
+		}
+		else
+		{
+			//beta == 0, so w's old values aren't read
+			ierr = VecAXPBY(w, a[0], 0, x[0]);CHKERRQ(ierr);
+			if(n > 1)
+			{
+				ierr = VecMAXPY(w, n - 1, a.data() + 1, x.data() + 1);CHKERRQ(ierr);
+			}
+		}
+		PetscFunctionReturn(0);
+	}
+
+private:
+
+	//plain host memory on every vector (and not e.g. CUDA/HIP/Kokkos, where borrowing the array costs a copy)
+	PetscErrorCode on_host(Vec w, PetscBool* host) const noexcept
+	{
+		PetscFunctionBeginHot;
+		PetscErrorCode ierr = PetscObjectTypeCompareAny((PetscObject)(w), host, VECSEQ, VECMPI, "");CHKERRQ(ierr);
+		for(std::size_t k = 0; k < N and *host; ++k)
+		{
+			ierr = PetscObjectTypeCompareAny((PetscObject)(m_vec[k]), host, VECSEQ, VECMPI, "");CHKERRQ(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	PetscErrorCode fused(Vec w) const noexcept
+	{
+		PetscFunctionBeginHot;
+		petsc_vec_array<petsc_vec_write> w_arr;
+		std::array<petsc_vec_array<petsc_vec_read>, N> x_arr;
+		std::array<const PetscScalar*, N> xp;
+		PetscErrorCode ierr = w_arr.acquire(w);CHKERRQ(ierr);
+		for(std::size_t k = 0; k < N; ++k)
+		{
+			ierr = x_arr[k].acquire(m_vec[k]);CHKERRQ(ierr);
+			if(x_arr[k].size() != w_arr.size())
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_INCOMP, "Vecs in an expression must have the same local size");
+			}
+			xp[k] = x_arr[k].data();
+		}
+
+		PetscScalar* wp = w_arr.data();
+		const std::size_t len = w_arr.size();
+		for(std::size_t i = 0; i < len; ++i)
+		{
+			PetscScalar s = m_coef[0]*xp[0][i];
+			for(std::size_t k = 1; k < N; ++k)
+			{
+				s += m_coef[k]*xp[k][i];
+			}
+			wp[i] = s;
+		}
+		ierr = PetscLogFlops(static_cast<PetscLogDouble>(2*N - 1)*len);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//w = w_coef*w + sum_k a[k]*x[k] in one pass, for the aliased case VecMAXPY() can't do alone
+	static PetscErrorCode fused_update(Vec w, PetscScalar w_coef, const std::array<PetscScalar, N>& a,
+					   const std::array<Vec, N>& x, PetscInt n) noexcept
+	{
+		PetscFunctionBeginHot;
+		petsc_vec_array<petsc_vec_read_write> w_arr;
+		std::array<petsc_vec_array<petsc_vec_read>, N> x_arr;
+		std::array<const PetscScalar*, N> xp;
+		PetscErrorCode ierr = w_arr.acquire(w);CHKERRQ(ierr);
+		for(PetscInt k = 0; k < n; ++k)
+		{
+			ierr = x_arr[k].acquire(x[k]);CHKERRQ(ierr);
+			if(x_arr[k].size() != w_arr.size())
+			{
+				SETERRQ(PETSC_COMM_SELF, PETSC_ERR_ARG_INCOMP, "Vecs in an expression must have the same local size");
+			}
+			xp[k] = x_arr[k].data();
+		}
+
+		PetscScalar* wp = w_arr.data();
+		const std::size_t len = w_arr.size();
+		for(std::size_t i = 0; i < len; ++i)
+		{
+			PetscScalar s = w_coef*wp[i];
+			for(PetscInt k = 0; k < n; ++k)
+			{
+				s += a[k]*xp[k][i];
+			}
+			wp[i] = s;
+		}
+		ierr = PetscLogFlops(static_cast<PetscLogDouble>(2*n + 1)*len);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	std::array<PetscScalar, N> m_coef;
+	std::array<Vec, N>         m_vec;//borrowed
+};
+
+template<std::size_t N>
+struct petsc_is_vec_expr<petsc_vec_lincomb<N>> : std::true_type
+{};
+
+
+/* what may appear in an expression: Vec handles (a one-term combination with coefficient 1) and combinations.
+ * The primary template is empty, so the operators below simply don't exist for anything else.
+ */
+template<typename T>
+struct petsc_vec_operand
+{};
+
+template<typename DestroyPolicy>
+struct petsc_vec_operand<petsc_smart_ptr<_p_Vec, DestroyPolicy>>
+{
+	static constexpr std::size_t size = 1;
+
+	static petsc_vec_lincomb<1> get(const petsc_smart_ptr<_p_Vec, DestroyPolicy>& x) noexcept
+	{
+		return petsc_vec_lincomb<1>({{PetscScalar(1)}}, {{x.get()}});
+	}
+};
+
+template<std::size_t N>
+struct petsc_vec_operand<petsc_vec_lincomb<N>>
+{
+	static constexpr std::size_t size = N;
+
+	static const petsc_vec_lincomb<N>& get(const petsc_vec_lincomb<N>& x) noexcept
+	{
+		return x;
+	}
+};
+
+
+//sign*r's terms appended to l's
+template<std::size_t N, std::size_t M>
+petsc_vec_lincomb<N + M> petsc_vec_concat(const petsc_vec_lincomb<N>& l, const petsc_vec_lincomb<M>& r, PetscScalar sign) noexcept
+{
+	std::array<PetscScalar, N + M> coef;
+	std::array<Vec, N + M>         vec;
+	for(std::size_t k = 0; k < N; ++k)
+	{
+		coef[k] = l.coefficients()[k];
+		vec[k] = l.vecs()[k];
+	}
+	for(std::size_t k = 0; k < M; ++k)
+	{
+		coef[N + k] = sign*r.coefficients()[k];
+		vec[N + k] = r.vecs()[k];
+	}
+	return petsc_vec_lincomb<N + M>(coef, vec);
+}
+
+template<typename L, typename R>
+petsc_vec_lincomb<petsc_vec_operand<L>::size + petsc_vec_operand<R>::size> operator+(const L& l, const R& r) noexcept
+{
+	return petsc_vec_concat(petsc_vec_operand<L>::get(l), petsc_vec_operand<R>::get(r), PetscScalar(1));
+}
+
+template<typename L, typename R>
+petsc_vec_lincomb<petsc_vec_operand<L>::size + petsc_vec_operand<R>::size> operator-(const L& l, const R& r) noexcept
+{
+	return petsc_vec_concat(petsc_vec_operand<L>::get(l), petsc_vec_operand<R>::get(r), PetscScalar(-1));
+}
+
+template<typename T>
+petsc_vec_lincomb<petsc_vec_operand<T>::size> operator*(PetscScalar alpha, const T& x) noexcept
+{
+	const auto& terms = petsc_vec_operand<T>::get(x);
+	std::array<PetscScalar, petsc_vec_operand<T>::size> coef = terms.coefficients();
+	for(PetscScalar& c : coef)
+	{
+		c *= alpha;
+	}
+	return petsc_vec_lincomb<petsc_vec_operand<T>::size>(coef, terms.vecs());
+}
+
+template<typename T>
+petsc_vec_lincomb<petsc_vec_operand<T>::size> operator*(const T& x, PetscScalar alpha) noexcept
+{
+	return alpha*x;
+}
+
+template<typename T>
+petsc_vec_lincomb<petsc_vec_operand<T>::size> operator-(const T& x) noexcept
+{
+	return PetscScalar(-1)*x;
+}
+
+#endif //PETSC_VEC_EXPR_HPP
@@ -0,0 +1,409 @@
+#ifndef PETSC_VIEWER_HPP
+#define PETSC_VIEWER_HPP
+
+#include "petsc_smart_ptr.hpp"
+extern "C" {
+#include <petscviewer.h>
+#if defined(PETSC_HAVE_HDF5)
+#include <petscviewerhdf5.h>
+#endif
+#include <petsc/private/viewerimpl.h>//struct _p_PetscViewer
+}
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+#define PETSC_SMART_PTR_HAVE_MMAP
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+#endif
+
+
+
+/* checkpoint/restart I/O. Two ways to do it:
+ *
+ * - PETSc's own formats through viewer handles. open_binary() turns on MPI-IO, so MatView()/VecView() (and the
+ *   handles' save()/load()) write and read per-rank contiguous pieces collectively instead of funneling
+ *   everything through rank 0; open_hdf5() does the same with parallel HDF5, whose datasets PETSc chunks by
+ *   ownership range. Files are portable (big-endian binary, or HDF5), any rank count can read them back.
+ *
+ * - raw restart files for Vecs (petsc_vec_save_raw()/petsc_vec_load_raw()/petsc_vec_load_mmap()): a small header
+ *   and then the entries in global order as native PetscScalars, so nothing is converted on the way in or out.
+ *   petsc_vec_load_mmap() maps each rank's range straight into a new Vec (copy on write, the file is never
+ *   modified), so a restart only faults in the pages it touches, and from the node-local page cache if the same
+ *   nodes wrote them. The files are only readable by builds with the same PetscScalar and endianness.
+ *
+ * petsc_handle<PetscViewer> viewer;
+ * ierr = petsc_handle<PetscViewer>::open_binary(comm, "jac.bin", FILE_MODE_WRITE, &viewer);CHKERRQ(ierr);
+ * ierr = J.save(viewer.get());CHKERRQ(ierr);
+ */
+
+
+
+template<>
+struct petsc_smart_ptr_log_traits<_p_PetscViewer>
+{
+	static const char* name() noexcept
+	{
+		return "Viewer";
+	}
+
+	static PetscClassId classid() noexcept
+	{
+		return PETSC_VIEWER_CLASSID;
+	}
+};
+
+
+//viewer type specialization
+template<typename DestroyPolicy>
+class petsc_smart_ptr<_p_PetscViewer, DestroyPolicy> :
+	public petsc_smart_ptr_base<petsc_smart_ptr<_p_PetscViewer, DestroyPolicy>, _p_PetscViewer, DestroyPolicy>
+{
+	using petsc_smart_ptr_base = ::petsc_smart_ptr_base<petsc_smart_ptr, _p_PetscViewer, DestroyPolicy>;
+	using petsc_smart_ptr_base::m_ptr;
+
+public:
+
+	//null handle
+	constexpr petsc_smart_ptr() noexcept : petsc_smart_ptr_base()
+	{};
+
+	//shares an existing viewer (takes a reference to it)
+	explicit petsc_smart_ptr(PetscViewer ptr) noexcept : petsc_smart_ptr_base(ptr)
+	{};
+
+	//takes over the caller's reference to an existing viewer
+	petsc_smart_ptr(PetscViewer ptr, petsc_adopt_t) noexcept : petsc_smart_ptr_base(ptr, petsc_adopt)
+	{};
+
+
+	//binary viewer on filename that reads/writes with collective MPI-IO (if PETSc was built with it, otherwise
+	//it's the usual rank 0 viewer)
+	static PetscErrorCode open_binary(MPI_Comm comm, const std::string& filename, PetscFileMode mode,
+					  petsc_smart_ptr* viewer) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_smart_ptr_log::scope<_p_PetscViewer> log(petsc_smart_ptr_log::create, NULL);
+		petsc_smart_ptr v;
+		PetscErrorCode ierr = PetscViewerCreate(comm, &v.m_ptr);CHKERRQ(ierr);
+		v.created();
+		ierr = PetscViewerSetType(v.m_ptr, PETSCVIEWERBINARY);CHKERRQ(ierr);
+#if defined(PETSC_HAVE_MPIIO)
+		ierr = PetscViewerBinarySetUseMPIIO(v.m_ptr, PETSC_TRUE);CHKERRQ(ierr);
+#endif
+		ierr = PetscViewerFileSetMode(v.m_ptr, mode);CHKERRQ(ierr);
+		ierr = PetscViewerFileSetName(v.m_ptr, filename.c_str());CHKERRQ(ierr);
+		ierr = viewer->reset(v.release(), petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+
+#if defined(PETSC_HAVE_HDF5)
+	//parallel HDF5 viewer on filename, with collective dataset transfers
+	static PetscErrorCode open_hdf5(MPI_Comm comm, const std::string& filename, PetscFileMode mode,
+					petsc_smart_ptr* viewer) noexcept
+	{
+		PetscFunctionBegin;
+		petsc_smart_ptr_log::scope<_p_PetscViewer> log(petsc_smart_ptr_log::create, NULL);
+		petsc_smart_ptr v;
+		PetscErrorCode ierr = PetscViewerCreate(comm, &v.m_ptr);CHKERRQ(ierr);
+		v.created();
+		ierr = PetscViewerSetType(v.m_ptr, PETSCVIEWERHDF5);CHKERRQ(ierr);
+		ierr = PetscViewerHDF5SetCollective(v.m_ptr, PETSC_TRUE);CHKERRQ(ierr);
+		ierr = PetscViewerFileSetMode(v.m_ptr, mode);CHKERRQ(ierr);
+		ierr = PetscViewerFileSetName(v.m_ptr, filename.c_str());CHKERRQ(ierr);
+		ierr = viewer->reset(v.release(), petsc_adopt);CHKERRQ(ierr);
+		PetscFunctionReturn(0);
+	}
+#endif
+
+
+	//typed destroy used by the base class
+	static PetscErrorCode destroy_object(PetscViewer* ptr) noexcept
+	{
+		return PetscViewerDestroy(ptr);
+	}
+};
+
+static_assert(sizeof(petsc_smart_ptr<_p_PetscViewer>) == sizeof(PetscViewer), "viewer handles must be as small as a raw PetscViewer");
+
+
+
+//header of a raw restart file, padded so the entries after it stay aligned
+struct petsc_raw_vec_header
+{
+	static constexpr std::uint64_t file_magic = 0x7065747363726177ull;//"petscraw"
+
+	std::uint64_t magic;
+	std::uint64_t size;       //global number of entries
+	std::uint64_t scalar_size;//sizeof(PetscScalar) of the writer
+	std::uint64_t reserved[5];
+};
+
+static_assert(sizeof(petsc_raw_vec_header) == 64, "raw restart header must stay 64 bytes");
+
+//closes an MPI file on scope exit, so errors in between don't leak it
+class petsc_mpi_file
+{
+public:
+
+	petsc_mpi_file() noexcept : m_fh(MPI_FILE_NULL)
+	{};
+
+	petsc_mpi_file(const petsc_mpi_file&) = delete;
+	petsc_mpi_file& operator=(const petsc_mpi_file&) = delete;
+
+	~petsc_mpi_file() noexcept
+	{
+		close();
+	}
+
+	PetscErrorCode open(MPI_Comm comm, const char filename[], int amode) noexcept
+	{
+		PetscFunctionBegin;
+		PetscErrorCode ierr = MPI_File_open(comm, filename, amode, MPI_INFO_NULL, &m_fh);CHKERRMPI(ierr);
+		PetscFunctionReturn(0);
+	}
+
+	//collective
+	PetscErrorCode close() noexcept
+	{
+		PetscFunctionBegin;
+		if(m_fh != MPI_FILE_NULL)
+		{
+			PetscErrorCode ierr = MPI_File_close(&m_fh);CHKERRMPI(ierr);
+		}
+		PetscFunctionReturn(0);
+	}
+
+	MPI_File get() const noexcept
+	{
+		return m_fh;
+	}
+
+private:
+
+	MPI_File m_fh;
+};
+
+//errors out unless header came from a raw restart file of N entries written by a build with our PetscScalar
+inline PetscErrorCode petsc_check_raw_vec_header(const petsc_raw_vec_header& header, PetscInt N) noexcept
+{
+	PetscFunctionBegin;
+	if(header.magic != petsc_raw_vec_header::file_magic)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_FILE_UNEXPECTED, "not a raw restart file (or written with the other endianness)");
+	}
+	if(header.scalar_size != sizeof(PetscScalar))
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_FILE_UNEXPECTED, "raw restart file was written with a different PetscScalar");
+	}
+	if(N != PETSC_DETERMINE and header.size != static_cast<std::uint64_t>(N))
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_FILE_UNEXPECTED, "raw restart file doesn't match the Vec's global size");
+	}
+	PetscFunctionReturn(0);
+}
+
+
+//writes vec to a raw restart file: every rank writes its own range with one collective MPI-IO call. Collective
+inline PetscErrorCode petsc_vec_save_raw(Vec vec, const std::string& filename) noexcept
+{
+	PetscFunctionBegin;
+	MPI_Comm comm;
+	PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(vec), &comm);CHKERRQ(ierr);
+	PetscMPIInt rank;
+	ierr = MPI_Comm_rank(comm, &rank);CHKERRMPI(ierr);
+	PetscInt N, rstart, rend;
+	ierr = VecGetSize(vec, &N);CHKERRQ(ierr);
+	ierr = VecGetOwnershipRange(vec, &rstart, &rend);CHKERRQ(ierr);
+	PetscMPIInt n;
+	ierr = PetscMPIIntCast(rend - rstart, &n);CHKERRQ(ierr);
+
+	petsc_vec_array<petsc_vec_read> values(vec);
+	if(not values)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "couldn't get the Vec's array");
+	}
+
+	petsc_mpi_file file;
+	ierr = file.open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY);CHKERRQ(ierr);
+	const MPI_Offset header_size = sizeof(petsc_raw_vec_header);
+	//an older, longer file would otherwise keep its tail
+	ierr = MPI_File_set_size(file.get(), header_size + static_cast<MPI_Offset>(N)*sizeof(PetscScalar));CHKERRMPI(ierr);
+	if(rank == 0)
+	{
+		petsc_raw_vec_header header = {petsc_raw_vec_header::file_magic, static_cast<std::uint64_t>(N), sizeof(PetscScalar), {0, 0, 0, 0, 0}};
+		ierr = MPI_File_write_at(file.get(), 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);CHKERRMPI(ierr);
+	}
+	ierr = MPI_File_write_at_all(file.get(), header_size + static_cast<MPI_Offset>(rstart)*sizeof(PetscScalar),
+				     values.data(), n, MPIU_SCALAR, MPI_STATUS_IGNORE);CHKERRMPI(ierr);
+	ierr = file.close();CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+template<typename DestroyPolicy>
+PetscErrorCode petsc_vec_save_raw(const petsc_smart_ptr<_p_Vec, DestroyPolicy>& vec, const std::string& filename) noexcept
+{
+	return petsc_vec_save_raw(vec.get(), filename);
+}
+
+//reads a raw restart file into vec (same global size, any layout), one collective MPI-IO read per rank
+inline PetscErrorCode petsc_vec_load_raw(Vec vec, const std::string& filename) noexcept
+{
+	PetscFunctionBegin;
+	MPI_Comm comm;
+	PetscErrorCode ierr = PetscObjectGetComm((PetscObject)(vec), &comm);CHKERRQ(ierr);
+	PetscInt N, rstart, rend;
+	ierr = VecGetSize(vec, &N);CHKERRQ(ierr);
+	ierr = VecGetOwnershipRange(vec, &rstart, &rend);CHKERRQ(ierr);
+	PetscMPIInt n;
+	ierr = PetscMPIIntCast(rend - rstart, &n);CHKERRQ(ierr);
+
+	petsc_mpi_file file;
+	ierr = file.open(comm, filename.c_str(), MPI_MODE_RDONLY);CHKERRQ(ierr);
+	petsc_raw_vec_header header;
+	ierr = MPI_File_read_at_all(file.get(), 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);CHKERRMPI(ierr);
+	//same header everywhere, so every rank errors out together
+	ierr = petsc_check_raw_vec_header(header, N);CHKERRQ(ierr);
+
+	petsc_vec_array<petsc_vec_write> values(vec);
+	if(not values)
+	{
+		SETERRQ(PETSC_COMM_SELF, PETSC_ERR_LIB, "couldn't get the Vec's array");
+	}
+	ierr = MPI_File_read_at_all(file.get(), sizeof(header) + static_cast<MPI_Offset>(rstart)*sizeof(PetscScalar),
+				    values.data(), n, MPIU_SCALAR, MPI_STATUS_IGNORE);CHKERRMPI(ierr);
+	ierr = file.close();CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+
+template<typename DestroyPolicy>
+PetscErrorCode petsc_vec_load_raw(const petsc_smart_ptr<_p_Vec, DestroyPolicy>& vec, const std::string& filename) noexcept
+{
+	return petsc_vec_load_raw(vec.get(), filename);
+}
+
+
+#if defined(PETSC_SMART_PTR_HAVE_MMAP)
+//a private mapping of part of a file; munmap()s it when destroyed. Attached to the Vec living in it
+class petsc_file_mapping
+{
+public:
+
+	petsc_file_mapping(void* addr, std::size_t len) noexcept : m_addr(addr), m_len(len)
+	{};
+
+	petsc_file_mapping(const petsc_file_mapping&) = delete;
+	petsc_file_mapping& operator=(const petsc_file_mapping&) = delete;
+
+	petsc_file_mapping(petsc_file_mapping&& mapping) noexcept : m_addr(mapping.m_addr), m_len(mapping.m_len)
+	{
+		mapping.m_addr = NULL;
+	}
+
+	~petsc_file_mapping() noexcept
+	{
+		if(m_addr)
+		{
+			munmap(m_addr, m_len);
+		}
+	}
+
+private:
+
+	void*       m_addr;
+	std::size_t m_len;
+};
+
+/* new Vec on comm backed by a raw restart file: each rank maps its own range (n entries, or PETSC_DECIDE for
+ * PETSc's default split) copy-on-write, so nothing is read until it's touched and writes to the Vec never reach
+ * the file. The mapping goes away with the Vec. Collective; a rank that can't open, check or map the file makes
+ * everybody error out.
+ */
+template<typename DestroyPolicy>
+PetscErrorCode petsc_vec_load_mmap(MPI_Comm comm, const std::string& filename, PetscInt n,
+				   petsc_smart_ptr<_p_Vec, DestroyPolicy>* vec) noexcept
+{
+	PetscFunctionBegin;
+	petsc_raw_vec_header header;
+	PetscMPIInt local_failed = 0, failed;
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0 or pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) or
+	   header.magic != petsc_raw_vec_header::file_magic or header.scalar_size != sizeof(PetscScalar))
+	{
+		local_failed = 1;
+	}
+	PetscErrorCode ierr = MPI_Allreduce(&local_failed, &failed, 1, MPI_INT, MPI_MAX, comm);
+	if(ierr or failed)
+	{
+		if(fd >= 0)
+		{
+			close(fd);
+		}
+		CHKERRMPI(ierr);
+		SETERRQ(comm, PETSC_ERR_FILE_READ, "couldn't open a raw restart file with our PetscScalar on every rank");
+	}
+
+	PetscInt N = static_cast<PetscInt>(header.size);
+	PetscInt rstart = 0;
+	ierr = PetscSplitOwnership(comm, &n, &N);
+	if(not ierr)
+	{
+		ierr = MPI_Exscan(&n, &rstart, 1, MPIU_INT, MPI_SUM, comm);
+	}
+	if(ierr)
+	{
+		close(fd);
+		CHKERRQ(ierr);
+	}
+	PetscMPIInt rank;
+	ierr = MPI_Comm_rank(comm, &rank);CHKERRMPI(ierr);
+	if(rank == 0)
+	{
+		rstart = 0;//MPI_Exscan leaves it undefined
+	}
+
+	//mapping past the end of the file would only show up as a SIGBUS on first touch, so check the file holds
+	//every entry the header promises
+	struct stat st;
+	local_failed = fstat(fd, &st) != 0 or
+		       st.st_size < static_cast<off_t>(sizeof(header)) + static_cast<off_t>(N)*static_cast<off_t>(sizeof(PetscScalar));
+	ierr = MPI_Allreduce(&local_failed, &failed, 1, MPI_INT, MPI_MAX, comm);
+	if(ierr or failed)
+	{
+		close(fd);
+		CHKERRMPI(ierr);
+		SETERRQ(comm, PETSC_ERR_FILE_UNEXPECTED, "raw restart file is shorter than its header says (truncated?)");
+	}
+
+	//mmap offsets have to be page aligned, so map from the page our range starts in
+	const off_t       offset = sizeof(header) + static_cast<off_t>(rstart)*sizeof(PetscScalar);
+	const off_t       page = sysconf(_SC_PAGESIZE);
+	const off_t       base = offset - offset % page;
+	const std::size_t len = static_cast<std::size_t>(offset - base) + static_cast<std::size_t>(n)*sizeof(PetscScalar);
+	void*             addr = NULL;
+	if(n > 0)
+	{
+		addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, base);
+		local_failed = addr == MAP_FAILED;
+	}
+	//the mapping doesn't need the descriptor
+	close(fd);
+	petsc_file_mapping mapping(local_failed ? NULL : addr, len);
+	ierr = MPI_Allreduce(&local_failed, &failed, 1, MPI_INT, MPI_MAX, comm);CHKERRMPI(ierr);
+	if(failed)
+	{
+		SETERRQ(comm, PETSC_ERR_FILE_READ, "couldn't map the raw restart file on every rank");
+	}
+
+	PetscScalar* values = n > 0 ? reinterpret_cast<PetscScalar*>(static_cast<char*>(addr) + (offset - base)) : NULL;
+	ierr = petsc_smart_ptr<_p_Vec, DestroyPolicy>::create_with_array(comm, 1, petsc_array_view<PetscScalar>(values, n), N, vec,
+									   std::move(mapping));CHKERRQ(ierr);
+	PetscFunctionReturn(0);
+}
+#endif
+
+#endif //PETSC_VIEWER_HPP